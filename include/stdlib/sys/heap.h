@@ -0,0 +1,35 @@
+#ifndef _SYS_HEAP_H
+#define _SYS_HEAP_H 1
+
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+
+#include "_AUX/config.h"
+
+// All sizes are in bytes.
+typedef struct
+{
+    uint64_t mapped;    // Memory currently taken from the system, arenas and large blocks
+    uint64_t used;      // Memory currently handed out, rounded up to the heap alignment, includes cached
+    uint64_t cached;    // Memory held in the caches of threads
+    uint64_t free;      // Memory in free blocks, all of it usable without taking more from the system
+    uint64_t freeBlocks;
+    uint64_t largestFree;
+    uint64_t arenas;
+    uint64_t largeBlocks; // Allocations mapped directly from the system
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t released; // Times memory was given back to the system
+} heap_stats_t;
+
+void heap_stats(heap_stats_t* stats);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
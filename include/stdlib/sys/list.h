@@ -81,6 +81,23 @@ static inline void list_push(list_t* list, void* elem)
     list_add(list->head.prev, &list->head, elem);
 }
 
+// Moves every element of src to the end of dest.
+static inline void list_splice(list_t* dest, list_t* src)
+{
+    if (list_empty(src))
+    {
+        return;
+    }
+
+    list_entry_t* first = src->head.next;
+    list_entry_t* last = src->head.prev;
+    first->prev = dest->head.prev;
+    dest->head.prev->next = first;
+    last->next = &dest->head;
+    dest->head.prev = last;
+    list_init(src);
+}
+
 static inline void* list_pop(list_t* list)
 {
     if (list_empty(list))
@@ -33,6 +33,16 @@ typedef struct
     fd_t parent;
 } spawn_fd_t;
 
+// Bit n allows cpu n, cpus above 63 are only allowed by CPU_MASK_ALL.
+typedef uint64_t cpumask_t;
+
+#define CPU_MASK_ALL ((cpumask_t)UINT64_MAX)
+
+typedef struct
+{
+    cpumask_t affinity;
+} spawn_attr_t;
+
 #define SPAWN_FD_END \
     (spawn_fd_t) \
     { \
@@ -48,8 +58,8 @@ nsec_t uptime(void);
 
 uint64_t sleep(nsec_t nanoseconds);
 
-// argv[0] = executable
-pid_t spawn(const char** argv, const spawn_fd_t* fds);
+// argv[0] = executable, if attr is NULL the child inherits the attributes of the calling thread.
+pid_t spawn(const char** argv, const spawn_fd_t* fds, const spawn_attr_t* attr);
 
 pid_t getpid(void);
 
@@ -67,6 +77,34 @@ _NORETURN void thread_exit(void);
 
 void yield(void);
 
+// Blocks until woken by futex_wake() or until timeout, unless the value at address no longer equals expected in which
+// case it fails with EAGAIN. Fails with ETIMEDOUT on timeout.
+uint64_t futex_wait(uint64_t* address, uint64_t expected, nsec_t timeout);
+
+// Wakes at most amount threads blocked in futex_wait() on address, returns the amount of threads woken.
+uint64_t futex_wake(uint64_t* address, uint64_t amount);
+
+#define NICE_MIN (-3)
+#define NICE_MAX 11
+
+// Sets the nice value of the calling thread, lower values give the thread a higher priority. Threads start with the
+// priority of the thread that created them.
+uint64_t nice(int64_t nice);
+
+// Restricts the calling thread to the cpus in mask, fails with EINVAL if mask contains no existing cpu. Threads start
+// with the affinity of the thread that created them.
+uint64_t affinity(cpumask_t mask);
+
+// Makes the calling thread a deadline thread that is guaranteed runtime within deadline of the start of every period,
+// requires runtime <= deadline <= period. Deadline threads run ahead of all other threads and are pinned to one cpu,
+// the call fails with EBUSY if no allowed cpu has enough unreserved time. A runtime of 0 makes the thread a normal
+// thread again, yield() gives up the rest of the runtime of the current period.
+uint64_t deadline(nsec_t runtime, nsec_t period, nsec_t deadline);
+
+// Sets the fs base of the calling thread, the base of its thread local storage. Threads start with a base that points
+// at a NULL pointer.
+uint64_t settls(void* base);
+
 #if defined(__cplusplus)
 }
 #endif
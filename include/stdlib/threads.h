@@ -20,6 +20,13 @@ enum
     thrd_error = 4
 };
 
+enum
+{
+    mtx_plain = 0,
+    mtx_recursive = 1,
+    mtx_timed = 2
+};
+
 typedef struct
 {
     uint64_t index;
@@ -27,6 +34,23 @@ typedef struct
 
 typedef int (*thrd_start_t)(void*);
 
+// The state is used as a futex, 0 is unlocked, 1 is locked and 2 is locked with possible waiters.
+typedef struct
+{
+    uint64_t state;
+    int type;
+    tid_t owner;
+    uint64_t depth;
+} mtx_t;
+
+// The sequence is used as a futex and incremented by every signal or broadcast, the kernel is only entered to wake
+// threads while waiters is not zero.
+typedef struct
+{
+    uint64_t sequence;
+    uint64_t waiters;
+} cnd_t;
+
 int thrd_create(thrd_t* thr, thrd_start_t func, void* arg);
 
 int thread_equal(thrd_t lhs, thrd_t rhs);
@@ -43,6 +67,32 @@ int thrd_detach(thrd_t thr);
 
 int thrd_join(thrd_t thr, int* res);
 
+// Timed functions take a time point relative to uptime() as there is no wall clock.
+
+int mtx_init(mtx_t* mtx, int type);
+
+int mtx_lock(mtx_t* mtx);
+
+int mtx_timedlock(mtx_t* mtx, const struct timespec* timePoint);
+
+int mtx_trylock(mtx_t* mtx);
+
+int mtx_unlock(mtx_t* mtx);
+
+void mtx_destroy(mtx_t* mtx);
+
+int cnd_init(cnd_t* cond);
+
+int cnd_signal(cnd_t* cond);
+
+int cnd_broadcast(cnd_t* cond);
+
+int cnd_wait(cnd_t* cond, mtx_t* mtx);
+
+int cnd_timedwait(cnd_t* cond, mtx_t* mtx, const struct timespec* timePoint);
+
+void cnd_destroy(cnd_t* cond);
+
 #if defined(__cplusplus)
 }
 #endif
@@ -0,0 +1,11 @@
+include Make.defaults
+
+TARGET := $(BINDIR)/top
+
+LDFLAGS += -Lbin/stdlib -lstd
+
+all: $(TARGET)
+
+.PHONY: all
+
+include Make.rules
@@ -30,6 +30,33 @@ void apic_timer_init(uint8_t vector, uint64_t hz)
     lapic_write(LAPIC_REG_TIMER_INITIAL_COUNT, ticks);
 }
 
+uint64_t apic_timer_calibrate(void)
+{
+    lapic_write(LAPIC_REG_TIMER_DIVIDER, APIC_TIMER_DIVIDER);
+    lapic_write(LAPIC_REG_TIMER_INITIAL_COUNT, 0xFFFFFFFF);
+
+    hpet_sleep(APIC_TIMER_CALIBRATE_TIME);
+
+    lapic_write(LAPIC_REG_LVT_TIMER, APIC_TIMER_MASKED);
+
+    uint32_t ticks = 0xFFFFFFFF - lapic_read(LAPIC_REG_TIMER_CURRENT_COUNT);
+    lapic_write(LAPIC_REG_TIMER_INITIAL_COUNT, 0);
+
+    return (uint64_t)ticks * (SEC / APIC_TIMER_CALIBRATE_TIME);
+}
+
+void apic_timer_one_shot(uint8_t vector, uint32_t ticks)
+{
+    lapic_write(LAPIC_REG_LVT_TIMER, ((uint32_t)vector) | APIC_TIMER_ONE_SHOT);
+    lapic_write(LAPIC_REG_TIMER_DIVIDER, APIC_TIMER_DIVIDER);
+    lapic_write(LAPIC_REG_TIMER_INITIAL_COUNT, ticks);
+}
+
+void apic_timer_stop(void)
+{
+    lapic_write(LAPIC_REG_TIMER_INITIAL_COUNT, 0);
+}
+
 void lapic_init(void)
 {
     msr_write(MSR_LAPIC, (msr_read(MSR_LAPIC) | LAPIC_MSR_ENABLE) & ~(1 << 10));
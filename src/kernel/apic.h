@@ -4,6 +4,10 @@
 
 #define APIC_TIMER_MASKED 0x10000
 #define APIC_TIMER_PERIODIC 0x20000
+#define APIC_TIMER_ONE_SHOT 0x00000
+
+#define APIC_TIMER_DIVIDER 0x3
+#define APIC_TIMER_CALIBRATE_TIME (SEC / 100)
 
 #define LAPIC_MSR_ENABLE 0x800
 
@@ -24,6 +28,13 @@ void apic_init(void);
 
 void apic_timer_init(uint8_t vector, uint64_t hz);
 
+// Returns the amount of lapic timer ticks per second.
+uint64_t apic_timer_calibrate(void);
+
+void apic_timer_one_shot(uint8_t vector, uint32_t ticks);
+
+void apic_timer_stop(void);
+
 void lapic_init(void);
 
 uint8_t lapic_id(void);
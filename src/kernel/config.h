@@ -1,9 +1,20 @@
 #pragma once
 
-#define CONFIG_TIME_SLICE (SEC / 100)
+#define CONFIG_TIME_SLICE_MIN (SEC / 500)
+#define CONFIG_TIME_SLICE_MAX (SEC / 25)
+#define CONFIG_SCHED_BOOST (SEC)
+#define CONFIG_SCHED_BALANCE (SEC / 20)
+#define CONFIG_SCHED_MIGRATE_COOLDOWN (SEC / 4)
+#define CONFIG_PRIORITY_HISTORY 8
 #define CONFIG_SCHED_HZ 1024
+#define CONFIG_SCHED_TICKLESS false
+#define CONFIG_SCHED_DEADLINE_UTIL 90
+#define CONFIG_IRQ_OFF_STATS false
+#define CONFIG_LOCK_STATS false
 #define CONFIG_KERNEL_STACK (PAGE_SIZE)
 #define CONFIG_USER_STACK (PAGE_SIZE)
 #define CONFIG_MAX_FD 64
 #define CONFIG_MAX_ARG 256
 #define CONFIG_LOG_SERIAL true
+#define CONFIG_DWM_FRAME_PERIOD (SEC / 60)
+#define CONFIG_DWM_FRAME_BUDGET (SEC / 250)
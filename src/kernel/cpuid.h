@@ -6,11 +6,16 @@
 #define CPUID_FEATURE_EXTENDED_ID 0x7
 #define CPUID_EXTENDED_STATE_ENUMERATION 0xD
 
+#define CPUID_EBX_INVPCID_AVAIL (1 << 10)
 #define CPUID_EBX_AVX512_AVAIL (1 << 16)
 
+#define CPUID_ECX_MONITOR_AVAIL (1 << 3)
+#define CPUID_ECX_PCID_AVAIL (1 << 17)
 #define CPUID_ECX_XSAVE_AVAIL (1 << 26)
 #define CPUID_ECX_AVX_AVAIL (1 << 28)
 
+#define CPUID_EAX_XSAVEOPT_AVAIL (1 << 0)
+
 static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx)
 {
     asm volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(subleaf));
@@ -40,3 +45,45 @@ static inline bool cpuid_avx512_avail(void)
     cpuid(CPUID_FEATURE_EXTENDED_ID, 0, &eax, &ebx, &unused, &unused);
     return (eax != 0) && (ebx & CPUID_EBX_AVX512_AVAIL);
 }
+
+static inline bool cpuid_monitor_avail(void)
+{
+    uint32_t ecx;
+    uint32_t unused;
+    cpuid(CPUID_FEATURE_ID, 0, &unused, &unused, &ecx, &unused);
+    return ecx & CPUID_ECX_MONITOR_AVAIL;
+}
+
+static inline bool cpuid_pcid_avail(void)
+{
+    uint32_t ecx;
+    uint32_t unused;
+    cpuid(CPUID_FEATURE_ID, 0, &unused, &unused, &ecx, &unused);
+    return ecx & CPUID_ECX_PCID_AVAIL;
+}
+
+static inline bool cpuid_invpcid_avail(void)
+{
+    uint32_t eax;
+    uint32_t ebx;
+    uint32_t unused;
+    cpuid(CPUID_FEATURE_EXTENDED_ID, 0, &eax, &ebx, &unused, &unused);
+    return (eax != 0) && (ebx & CPUID_EBX_INVPCID_AVAIL);
+}
+
+static inline bool cpuid_xsaveopt_avail(void)
+{
+    uint32_t eax;
+    uint32_t unused;
+    cpuid(CPUID_EXTENDED_STATE_ENUMERATION, 1, &eax, &unused, &unused, &unused);
+    return eax & CPUID_EAX_XSAVEOPT_AVAIL;
+}
+
+// Size of the xsave area for the features currently enabled in XCR0.
+static inline uint64_t cpuid_xsave_size(void)
+{
+    uint32_t ebx;
+    uint32_t unused;
+    cpuid(CPUID_EXTENDED_STATE_ENUMERATION, 0, &unused, &ebx, &unused, &unused);
+    return ebx;
+}
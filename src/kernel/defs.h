@@ -11,9 +11,14 @@
 #define NORETURN __attribute__((noreturn))
 #define NOINLINE __attribute__((noinline))
 
+#define CONTAINER_OF(ptr, type, member) ((type*)((uintptr_t)(ptr) - offsetof(type, member)))
+
 #define CONCAT(a, b) CONCAT_INNER(a, b)
 #define CONCAT_INNER(a, b) a##b
 
+#define STRINGIFY(a) STRINGIFY_INNER(a)
+#define STRINGIFY_INNER(a) #a
+
 #define ERROR(code) \
     ({ \
         sched_thread()->error = code; \
@@ -9,9 +9,11 @@
 #include <sys/math.h>
 #include <sys/mouse.h>
 
+#include "_AUX/ERR.h"
 #include "lock.h"
 #include "log.h"
 #include "msg_queue.h"
+#include "mutex.h"
 #include "sched.h"
 #include "sys/kbd.h"
 #include "sysfs.h"
@@ -34,12 +36,26 @@ static window_t* wall;
 static file_t* mouse;
 static file_t* keyboard;
 
-static lock_t lock;
+// Protects the window list and the global window state. A whole frame is drawn with it held, so it is a sleeping lock
+// that leaves interrupts enabled. The dwm thread is a deadline thread and the mutex has no priority inheritance, so
+// every other thread takes it with MUTEX_GUARD_NO_PREEMPT() and keeps its section short, a preempted client would
+// otherwise hold up the frame for as long as it stays preempted.
+static mutex_t lock;
 
 static atomic_bool redrawNeeded;
 
 static blocker_t blocker;
 
+// Set if the dwm thread was admitted as a deadline thread, it then draws at most one frame per CONFIG_DWM_FRAME_PERIOD.
+static bool framePeriodic;
+
+// Frame start jitter, only written by the dwm thread.
+static nsec_t frameLast;
+static uint64_t frameAmount;
+static uint64_t frameLate;
+static nsec_t frameJitterTotal;
+static nsec_t frameJitterMax;
+
 static void dwm_update_client_rect_unlocked(void)
 {
     rect_t newRect = RECT_INIT_DIM(0, 0, backbuffer.width, backbuffer.height);
@@ -367,13 +383,50 @@ static void dwm_poll_keyboard(void)
     }
 }
 
+// Measures how far the start of a frame was from one period after the start of the previous frame, a frame that started
+// more than a tenth of a period late is counted as late.
+static void dwm_frame_begin(void)
+{
+    nsec_t uptime = time_uptime();
+    if (frameLast != 0)
+    {
+        nsec_t interval = uptime - frameLast;
+        nsec_t jitter = interval > CONFIG_DWM_FRAME_PERIOD ? interval - CONFIG_DWM_FRAME_PERIOD
+                                                           : CONFIG_DWM_FRAME_PERIOD - interval;
+        frameAmount++;
+        frameJitterTotal += jitter;
+        frameJitterMax = MAX(frameJitterMax, jitter);
+        if (interval > CONFIG_DWM_FRAME_PERIOD + CONFIG_DWM_FRAME_PERIOD / 10)
+        {
+            frameLate++;
+        }
+    }
+    frameLast = uptime;
+}
+
 static void dwm_poll(void)
 {
+    if (framePeriodic)
+    {
+        // Gives up the rest of the frame budget, inputs are polled at the start of every period.
+        do
+        {
+            sched_yield();
+            dwm_frame_begin();
+
+            MUTEX_GUARD(&lock);
+
+            dwm_poll_mouse();
+            dwm_poll_keyboard();
+        } while (!atomic_exchange_explicit(&redrawNeeded, false, __ATOMIC_RELAXED));
+        return;
+    }
+
     while (!atomic_exchange_explicit(&redrawNeeded, false, __ATOMIC_RELAXED))
     {
         sched_block(&blocker, SEC / 256);
 
-        LOCK_GUARD(&lock);
+        MUTEX_GUARD(&lock);
 
         dwm_poll_mouse();
         dwm_poll_keyboard();
@@ -382,9 +435,16 @@ static void dwm_poll(void)
 
 static void dwm_loop(void)
 {
+    framePeriodic =
+        sched_deadline(CONFIG_DWM_FRAME_BUDGET, CONFIG_DWM_FRAME_PERIOD, CONFIG_DWM_FRAME_PERIOD) != ERR;
+    if (!framePeriodic)
+    {
+        log_print("dwm: frame deadline not admitted");
+    }
+
     while (1)
     {
-        lock_acquire(&lock);
+        mutex_acquire(&lock);
         if (wall != NULL)
         {
             dwm_draw_wall();
@@ -395,15 +455,23 @@ static void dwm_loop(void)
             }
             dwm_swap();
         }
-        lock_release(&lock);
+        mutex_release(&lock);
 
         dwm_poll();
     }
 }
 
+static void dwm_stats_print(sysfs_text_t* text, void* private)
+{
+    sysfs_text_print(text, "mode %s\n", framePeriodic ? "deadline" : "blocking");
+    sysfs_text_print(text, "frames late jitter_avg_us jitter_max_us\n");
+    sysfs_text_print(text, "%d %d %d %d\n", frameAmount, frameLate,
+        frameAmount != 0 ? frameJitterTotal / frameAmount / (SEC / 1000000) : 0, frameJitterMax / (SEC / 1000000));
+}
+
 static void dwm_window_cleanup(window_t* window)
 {
-    LOCK_GUARD(&lock);
+    MUTEX_GUARD_NO_PREEMPT(&lock);
 
     if (window == selected)
     {
@@ -453,8 +521,6 @@ static void dwm_window_cleanup(window_t* window)
 
 static uint64_t dwm_ioctl(file_t* file, uint64_t request, void* argp, uint64_t size)
 {
-    LOCK_GUARD(&lock);
-
     switch (request)
     {
     case IOCTL_DWM_CREATE:
@@ -465,11 +531,14 @@ static uint64_t dwm_ioctl(file_t* file, uint64_t request, void* argp, uint64_t s
         }
         const ioctl_dwm_create_t* create = argp;
 
+        // Allocated before the lock is taken, clearing the buffer of a large window takes long.
         window_t* window = window_new(&create->pos, create->width, create->height, create->type, dwm_window_cleanup);
         if (window == NULL)
         {
             return ERR;
         }
+
+        MUTEX_GUARD_NO_PREEMPT(&lock);
         LOCK_GUARD(&window->lock);
 
         switch (window->type)
@@ -529,6 +598,7 @@ static uint64_t dwm_ioctl(file_t* file, uint64_t request, void* argp, uint64_t s
         {
             return ERROR(EINVAL);
         }
+        MUTEX_GUARD_NO_PREEMPT(&lock);
 
         ioctl_dwm_size_t* size = argp;
         size->outWidth = RECT_WIDTH(&screenRect);
@@ -569,7 +639,7 @@ void dwm_init(gop_buffer_t* gopBuffer)
     cursor = NULL;
     wall = NULL;
 
-    lock_init(&lock);
+    mutex_init(&lock);
 
     // TODO: Add system to choose input devices
     mouse = vfs_open("sys:/mouse/ps2");
@@ -578,7 +648,15 @@ void dwm_init(gop_buffer_t* gopBuffer)
     atomic_init(&redrawNeeded, true);
     blocker_init(&blocker);
 
+    framePeriodic = false;
+    frameLast = 0;
+    frameAmount = 0;
+    frameLate = 0;
+    frameJitterTotal = 0;
+    frameJitterMax = 0;
+
     sysfs_expose("/", "dwm", &fileOps, NULL, NULL, NULL);
+    sysfs_expose_text("/stats", "dwm", dwm_stats_print, NULL);
 }
 
 void dwm_start(void)
@@ -599,7 +677,7 @@ void dwm_redraw(void)
 
 void dwm_update_client_rect(void)
 {
-    LOCK_GUARD(&lock);
+    MUTEX_GUARD_NO_PREEMPT(&lock);
 
     dwm_update_client_rect_unlocked();
 }
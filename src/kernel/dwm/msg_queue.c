@@ -36,15 +36,23 @@ void msg_queue_push(msg_queue_t* queue, msg_type_t type, const void* data, uint6
     memcpy(msg->data, data, size);
     queue->writeIndex = (queue->writeIndex + 1) % MSG_QUEUE_MAX;
 
-    sched_unblock(&queue->blocker);
+    // Every message is consumed by exactly one pop.
+    sched_unblock_one(&queue->blocker);
 }
 
 void msg_queue_pop(msg_queue_t* queue, msg_t* msg, nsec_t timeout)
 {
-    if (SCHED_BLOCK_LOCK_TIMEOUT(&queue->blocker, &queue->lock, queue->readIndex != queue->writeIndex, timeout) != BLOCK_NORM)
+    if (SCHED_BLOCK_LOCK_TIMEOUT_EXCLUSIVE(&queue->blocker, &queue->lock, queue->readIndex != queue->writeIndex, timeout) !=
+        BLOCK_NORM)
     {
+        // The deadline may have passed after this thread was chosen to receive a message, if so pass it on.
+        bool avail = queue->readIndex != queue->writeIndex;
         *msg = (msg_t){.type = MSG_NONE};
         lock_release(&queue->lock);
+        if (avail)
+        {
+            sched_unblock_one(&queue->blocker);
+        }
         return;
     }
 
@@ -3,6 +3,7 @@
 #include "dwm.h"
 #include "dwm/msg_queue.h"
 #include "lock.h"
+#include "slab.h"
 #include "vfs.h"
 
 #include <errno.h>
@@ -11,6 +12,8 @@
 #include <sys/gfx.h>
 #include <sys/math.h>
 
+static slab_cache_t windowCache = SLAB_CACHE_INIT(window_t, NULL);
+
 static void window_cleanup(file_t* file)
 {
     window_t* window = file->private;
@@ -131,7 +134,7 @@ window_t* window_new(const point_t* pos, uint32_t width, uint32_t height, dwm_ty
         return NULL;
     }
 
-    window_t* window = malloc(sizeof(window_t));
+    window_t* window = slab_alloc(&windowCache);
     list_entry_init(&window->entry);
     window->pos = *pos;
     window->type = type;
@@ -154,7 +157,7 @@ void window_free(window_t* window)
 {
     msg_queue_cleanup(&window->messages);
     free(window->gfx.buffer);
-    free(window);
+    slab_free(&windowCache, window);
 }
 
 static file_ops_t fileOps = {
@@ -0,0 +1,124 @@
+#include "futex.h"
+
+#include "log.h"
+#include "sched.h"
+#include "vmm.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+
+static futex_bucket_t buckets[FUTEX_BUCKET_AMOUNT];
+
+static futex_bucket_t* futex_bucket(uintptr_t address)
+{
+    return &buckets[((address / sizeof(uint64_t)) * 0x9E3779B97F4A7C15ULL) >> 58];
+}
+
+static futex_t* futex_find(futex_bucket_t* bucket, uintptr_t address)
+{
+    futex_t* futex;
+    LIST_FOR_EACH(futex, &bucket->futexes)
+    {
+        if (futex->address == address)
+        {
+            return futex;
+        }
+    }
+
+    return NULL;
+}
+
+// The futex stays allocated as long as it has waiters, the bucket lock must be held.
+static futex_t* futex_ref(futex_bucket_t* bucket, uintptr_t address)
+{
+    futex_t* futex = futex_find(bucket, address);
+    if (futex == NULL)
+    {
+        futex = malloc(sizeof(futex_t));
+        list_entry_init(&futex->entry);
+        futex->address = address;
+        futex->waiters = 0;
+        blocker_init(&futex->blocker);
+        list_push(&bucket->futexes, futex);
+    }
+
+    futex->waiters++;
+    return futex;
+}
+
+static void futex_unref(futex_t* futex)
+{
+    futex->waiters--;
+    if (futex->waiters == 0)
+    {
+        list_remove(futex);
+        blocker_cleanup(&futex->blocker);
+        free(futex);
+    }
+}
+
+void futex_init(void)
+{
+    for (uint64_t i = 0; i < FUTEX_BUCKET_AMOUNT; i++)
+    {
+        list_init(&buckets[i].futexes);
+        lock_init(&buckets[i].lock);
+    }
+
+    log_print("futex: init");
+}
+
+uint64_t futex_wait(uint64_t* address, uint64_t expected, nsec_t timeout)
+{
+    uintptr_t physical = (uintptr_t)vmm_phys_addr(address);
+    if (physical == 0)
+    {
+        return ERROR(EFAULT);
+    }
+
+    futex_bucket_t* bucket = futex_bucket(physical);
+    lock_acquire(&bucket->lock);
+
+    futex_t* futex = futex_ref(bucket, physical);
+
+    // Wakers hold the bucket lock while unblocking, so any change to the value after this check also bumps the
+    // generation and the block below returns immediately. The value is read through the higher half so that a
+    // concurrent unmap can not fault while the lock is held.
+    uint64_t generation = blocker_generation(&futex->blocker);
+    if (atomic_load((atomic_uint64_t*)VMM_LOWER_TO_HIGHER(physical)) != expected)
+    {
+        futex_unref(futex);
+        lock_release(&bucket->lock);
+        return ERROR(EAGAIN);
+    }
+
+    lock_release(&bucket->lock);
+
+    block_result_t result = sched_block_exclusive(&futex->blocker, generation, timeout);
+
+    lock_acquire(&bucket->lock);
+    futex_unref(futex);
+    lock_release(&bucket->lock);
+
+    return result == BLOCK_TIMEOUT ? ERROR(ETIMEDOUT) : 0;
+}
+
+uint64_t futex_wake(uint64_t* address, uint64_t amount)
+{
+    uintptr_t physical = (uintptr_t)vmm_phys_addr(address);
+    if (physical == 0)
+    {
+        return ERROR(EFAULT);
+    }
+
+    futex_bucket_t* bucket = futex_bucket(physical);
+    LOCK_GUARD(&bucket->lock);
+
+    futex_t* futex = futex_find(bucket, physical);
+    if (futex == NULL)
+    {
+        return 0;
+    }
+
+    return sched_unblock_n(&futex->blocker, amount);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "defs.h"
+#include "lock.h"
+#include "sched.h"
+
+#include <sys/list.h>
+
+#define FUTEX_BUCKET_AMOUNT 64
+
+// Futexes are keyed by the physical address of the waited on word, so processes sharing memory also share futexes.
+typedef struct
+{
+    list_entry_t entry;
+    uintptr_t address;
+    uint64_t waiters;
+    blocker_t blocker;
+} futex_t;
+
+typedef struct
+{
+    list_t futexes;
+    lock_t lock;
+} futex_bucket_t;
+
+void futex_init(void);
+
+// Blocks until woken or until timeout if the value at address equals expected.
+uint64_t futex_wait(uint64_t* address, uint64_t expected, nsec_t timeout);
+
+// Wakes at most amount threads waiting on address, returns the amount of threads woken.
+uint64_t futex_wake(uint64_t* address, uint64_t amount);
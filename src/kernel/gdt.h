@@ -6,8 +6,9 @@
 #define GDT_NULL 0x00
 #define GDT_KERNEL_CODE 0x08
 #define GDT_KERNEL_DATA 0x10
-#define GDT_USER_CODE 0x18
-#define GDT_USER_DATA 0x20
+// Sysret requires the user data segment to directly precede the user code segment.
+#define GDT_USER_DATA 0x18
+#define GDT_USER_CODE 0x20
 #define GDT_TSS 0x28
 
 #define GDT_RING3 3
@@ -48,8 +49,8 @@ typedef struct PACKED
     gdt_entry_t null;
     gdt_entry_t kernelCode;
     gdt_entry_t kernelData;
-    gdt_entry_t userCode;
     gdt_entry_t userData;
+    gdt_entry_t userCode;
     gdt_long_entry_t tssDesc;
 } gdt_t;
 
@@ -1,7 +1,5 @@
 #include "idt.h"
 
-#include "syscall.h"
-
 #include <sys/proc.h>
 
 ALIGNED(PAGE_SIZE) static idt_t idt;
@@ -27,7 +25,6 @@ void idt_init(void)
     {
         idt_set_vector((uint8_t)vector, vectorTable[vector], IDT_RING0, IDT_INTERRUPT_GATE);
     }
-    idt_set_vector(SYSCALL_VECTOR, syscall_handler, IDT_RING3, IDT_TRAP_GATE);
 
     idt_load();
 }
@@ -12,16 +12,23 @@ static uint64_t kbd_read(file_t* file, void* buffer, uint64_t count)
     kbd_t* kbd = file->private;
 
     count = ROUND_DOWN(count, sizeof(kbd_event_t));
-    for (uint64_t i = 0; i < count / sizeof(kbd_event_t); i++)
+    uint64_t amount = count / sizeof(kbd_event_t);
+    uint64_t i = 0;
+    while (i < amount)
     {
+        // Every open file has its own position so all readers are woken by a push, each wake then drains every
+        // available event with a single acquisition of the lock.
         if (SCHED_BLOCK_LOCK(&kbd->blocker, &kbd->lock, file->pos != kbd->writeIndex) != BLOCK_NORM)
         {
             lock_release(&kbd->lock);
             return i * sizeof(kbd_event_t);
         }
 
-        ((kbd_event_t*)buffer)[i] = kbd->events[file->pos];
-        file->pos = (file->pos + 1) % KBD_MAX_EVENT;
+        while (i < amount && file->pos != kbd->writeIndex)
+        {
+            ((kbd_event_t*)buffer)[i++] = kbd->events[file->pos];
+            file->pos = (file->pos + 1) % KBD_MAX_EVENT;
+        }
 
         lock_release(&kbd->lock);
     }
@@ -4,9 +4,11 @@
 #include "apic.h"
 #include "const.h"
 #include "dwm/dwm.h"
+#include "futex.h"
 #include "gdt.h"
 #include "hpet.h"
 #include "idt.h"
+#include "lock.h"
 #include "log.h"
 #include "madt.h"
 #include "pic.h"
@@ -16,7 +18,10 @@
 #include "regs.h"
 #include "sched.h"
 #include "simd.h"
+#include "slab.h"
 #include "smp.h"
+#include "space.h"
+#include "syscall.h"
 #include "sysfs.h"
 #include "time.h"
 #include "vfs.h"
@@ -54,9 +59,14 @@ void kernel_init(boot_info_t* bootInfo)
 
     smp_init();
     sched_init();
+    futex_init();
 
     vfs_init();
     sysfs_init();
+    pmm_expose_stats();
+    slab_expose_stats();
+    space_expose_stats();
+    lock_expose_stats();
 
     log_enable_screen(&bootInfo->gopBuffer);
 
@@ -68,6 +78,7 @@ void kernel_init(boot_info_t* bootInfo)
 
     pic_init();
     simd_init();
+    syscall_init();
     time_init();
     log_enable_time();
 
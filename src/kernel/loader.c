@@ -96,6 +96,8 @@ static void* loader_load_program(thread_t* thread)
     return (void*)header.entry;
 }
 
+// The top of the stack is the initial thread local storage of the thread, a NULL pointer until the thread calls
+// settls(), so that fs relative loads never fault. Returns the initial stack pointer, which is also the tls base.
 static void* loader_allocate_stack(thread_t* thread)
 {
     void* address = (void*)(VMM_LOWER_HALF_MAX - (CONFIG_USER_STACK * (thread->id + 1) + PAGE_SIZE * (thread->id)));
@@ -104,7 +106,10 @@ static void* loader_allocate_stack(thread_t* thread)
         return NULL;
     }
 
-    return address + CONFIG_USER_STACK;
+    // Two words keep the stack 16 byte aligned.
+    uint64_t* tls = (uint64_t*)(address + CONFIG_USER_STACK) - 2;
+    tls[0] = 0;
+    return tls;
 }
 
 static void loader_spawn_entry(void)
@@ -117,6 +122,7 @@ static void loader_spawn_entry(void)
         log_print("loader: stack failure (%s, %d)", thread->process->argv[0], thread->process->id);
         sched_process_exit(EEXEC);
     }
+    thread_tls_set(rsp);
 
     void* rip = loader_load_program(thread);
     if (rip == NULL)
@@ -179,6 +185,7 @@ thread_t* loader_split(thread_t* thread, void* entry, priority_t priority, uint6
     child->trapFrame.cs = GDT_USER_CODE | GDT_RING3;
     child->trapFrame.ss = GDT_USER_DATA | GDT_RING3;
     child->trapFrame.rsp = (uint64_t)rsp;
+    child->tlsBase = rsp;
 
     if (argc >= 1)
     {
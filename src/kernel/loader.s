@@ -23,6 +23,8 @@ loader_jump_to_user_space:
     xor r14, r14
     xor r15, r15
 
+    cli
+    swapgs
     push GDT_USER_DATA | 3
     push rdi
     push RFLAGS_INTERRUPT_ENABLE | RFLAGS_ALWAYS_SET
@@ -0,0 +1,147 @@
+#include "lock.h"
+
+#include "smp.h"
+#include "sysfs.h"
+
+void lock_acquire_slow(lock_t* lock)
+{
+    cpu_t* self = smp_self_unsafe();
+    lock_node_t* node = &self->lockNode;
+    atomic_store(&node->next, NULL);
+    atomic_store(&node->first, false);
+
+    uint32_t tail = ((uint32_t)self->id + 1) << LOCK_TAIL_SHIFT;
+    uint32_t value = atomic_load(&lock->value);
+    while (!atomic_compare_exchange_weak(&lock->value, &value, (value & LOCK_LOCKED) | tail))
+    {
+    }
+
+    uint32_t prevTail = value >> LOCK_TAIL_SHIFT;
+    if (prevTail != 0)
+    {
+        lock_node_t* prev = &smp_cpu(prevTail - 1)->lockNode;
+        atomic_store(&prev->next, node);
+        while (!atomic_load(&node->first))
+        {
+            asm volatile("pause");
+        }
+    }
+
+    // First in line, only this cpu spins on the lock word.
+    while (1)
+    {
+        value = atomic_load(&lock->value);
+        if (value & LOCK_LOCKED)
+        {
+            asm volatile("pause");
+            continue;
+        }
+
+        // Clear the tail if no one queued up behind this cpu, otherwise leave it for the last waiter.
+        uint32_t desired = (value == tail) ? LOCK_LOCKED : (value | LOCK_LOCKED);
+        if (atomic_compare_exchange_weak(&lock->value, &value, desired))
+        {
+            if (value == tail)
+            {
+                return;
+            }
+            break;
+        }
+    }
+
+    // Someone queued up behind this cpu, it might not have linked itself to this node yet.
+    lock_node_t* next;
+    while ((next = atomic_load(&node->next)) == NULL)
+    {
+        asm volatile("pause");
+    }
+    atomic_store(&next->first, true);
+}
+
+#if CONFIG_LOCK_STATS
+// Sites past this amount share the last entry.
+#define LOCK_STAT_SITES 256
+
+static lock_stat_t stats[LOCK_STAT_SITES];
+
+// Lock free open addressing on the address of the site string, every acquisition at one site passes the same literal.
+static lock_stat_t* lock_stat_get(const char* site)
+{
+    uint64_t hash = ((uintptr_t)site >> 3) * 0x9E3779B97F4A7C15ULL;
+    for (uint64_t i = 0; i < LOCK_STAT_SITES - 1; i++)
+    {
+        lock_stat_t* stat = &stats[(hash + i) % (LOCK_STAT_SITES - 1)];
+
+        const char* current = atomic_load(&stat->site);
+        if (current == site)
+        {
+            return stat;
+        }
+
+        if (current == NULL)
+        {
+            if (atomic_compare_exchange_strong(&stat->site, &current, site) || current == site)
+            {
+                return stat;
+            }
+        }
+    }
+
+    lock_stat_t* overflow = &stats[LOCK_STAT_SITES - 1];
+    const char* expected = NULL;
+    atomic_compare_exchange_strong(&overflow->site, &expected, "other");
+    return overflow;
+}
+
+void lock_stat_acquired(lock_t* lock, const char* site, bool contended, uint64_t spinCycles)
+{
+    lock_stat_t* stat = lock_stat_get(site);
+    atomic_fetch_add_explicit(&stat->acquisitions, 1, memory_order_relaxed);
+    if (contended)
+    {
+        atomic_fetch_add_explicit(&stat->contended, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&stat->spinCycles, spinCycles, memory_order_relaxed);
+    }
+
+    lock->stat = stat;
+    lock->acquireTime = tsc_read();
+}
+
+void lock_stat_released(lock_t* lock)
+{
+    lock_stat_t* stat = lock->stat;
+    uint64_t hold = tsc_read() - lock->acquireTime;
+    atomic_fetch_add_explicit(&stat->holdCycles, hold, memory_order_relaxed);
+
+    uint64_t max = atomic_load_explicit(&stat->holdMax, memory_order_relaxed);
+    while (hold > max && !atomic_compare_exchange_weak(&stat->holdMax, &max, hold))
+    {
+    }
+}
+
+static void lock_stats_print(sysfs_text_t* text, void* private)
+{
+    sysfs_text_print(text, "site acquisitions contended spin_cycles hold_avg hold_max\n");
+
+    for (uint64_t i = 0; i < LOCK_STAT_SITES; i++)
+    {
+        lock_stat_t* stat = &stats[i];
+        const char* site = atomic_load(&stat->site);
+        uint64_t acquisitions = atomic_load(&stat->acquisitions);
+        if (site == NULL || acquisitions == 0)
+        {
+            continue;
+        }
+
+        sysfs_text_print(text, "%s %d %d %d %d %d\n", site, acquisitions, atomic_load(&stat->contended),
+            atomic_load(&stat->spinCycles), atomic_load(&stat->holdCycles) / acquisitions, atomic_load(&stat->holdMax));
+    }
+}
+#endif
+
+void lock_expose_stats(void)
+{
+#if CONFIG_LOCK_STATS
+    sysfs_expose_text("/stats", "locks", lock_stats_print, NULL);
+#endif
+}
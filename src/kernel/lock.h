@@ -3,39 +3,124 @@
 #include <stdatomic.h>
 
 #include "defs.h"
+#include "regs.h"
 #include "trap.h"
 
+#define LOCK_LOCKED 1
+#define LOCK_TAIL_SHIFT 16
+
+#if CONFIG_LOCK_STATS
+// Statistics of every lock acquired at one site, times are in tsc cycles.
+typedef struct lock_stat
+{
+    _Atomic(const char*) site;
+    atomic_uint64_t acquisitions;
+    atomic_uint64_t contended;
+    atomic_uint64_t spinCycles;
+    atomic_uint64_t holdCycles;
+    atomic_uint64_t holdMax;
+} lock_stat_t;
+#endif
+
+// Queued spinlock, the lock word holds the locked bit and the id + 1 of the last cpu waiting in line. Only the first
+// waiter spins on the lock word, every other waiter spins on the lock_node_t of its own cpu until the waiter ahead of it
+// takes the lock, so a contended lock does not bounce one cache line between every waiting cpu.
 typedef struct
 {
-    atomic_uint32_t nextTicket;
-    atomic_uint32_t nowServing;
+    atomic_uint32_t value;
+#if CONFIG_LOCK_STATS
+    lock_stat_t* stat; // Site of the current holder
+    uint64_t acquireTime;
+#endif
 } lock_t;
 
+// Waiters spin with interrupts disabled and so only ever wait for one lock at a time, one node per cpu is enough.
+typedef struct lock_node
+{
+    _Atomic(struct lock_node*) next;
+    atomic_bool first; // Set by the waiter ahead once it has taken the lock
+} lock_node_t;
+
+#if CONFIG_LOCK_STATS
+#define LOCK_SITE __FILE__ ":" STRINGIFY(__LINE__)
+#else
+#define LOCK_SITE NULL
+#endif
+
+// Statistics are keyed by the site that acquires the lock, so these are macros.
+#define lock_acquire(lock) lock_acquire_site(lock, LOCK_SITE)
+#define lock_try_acquire(lock) lock_try_acquire_site(lock, LOCK_SITE)
+
 #define LOCK_GUARD(lock) \
     __attribute__((cleanup(lock_cleanup))) lock_t* CONCAT(l, __COUNTER__) = (lock); \
     lock_acquire((lock))
 
+// Joins the queue of a contended lock, called with interrupts disabled.
+void lock_acquire_slow(lock_t* lock);
+
+#if CONFIG_LOCK_STATS
+void lock_stat_acquired(lock_t* lock, const char* site, bool contended, uint64_t spinCycles);
+
+void lock_stat_released(lock_t* lock);
+#endif
+
+// Exposes sys:/stats/locks if CONFIG_LOCK_STATS is enabled.
+void lock_expose_stats(void);
+
 static inline void lock_init(lock_t* lock)
 {
-    atomic_init(&lock->nextTicket, 0);
-    atomic_init(&lock->nowServing, 0);
+    atomic_init(&lock->value, 0);
+#if CONFIG_LOCK_STATS
+    lock->stat = NULL;
+    lock->acquireTime = 0;
+#endif
 }
 
-static inline void lock_acquire(lock_t* lock)
+static inline void lock_acquire_site(lock_t* lock, const char* site)
 {
     cli_push();
 
-    // Overflow does not matter
-    uint32_t ticket = atomic_fetch_add(&lock->nextTicket, 1);
-    while (atomic_load(&lock->nowServing) != ticket)
+    uint32_t expected = 0;
+    if (atomic_compare_exchange_strong(&lock->value, &expected, LOCK_LOCKED))
     {
-        asm volatile("pause");
+#if CONFIG_LOCK_STATS
+        lock_stat_acquired(lock, site, false, 0);
+#endif
+        return;
     }
+
+#if CONFIG_LOCK_STATS
+    uint64_t start = tsc_read();
+    lock_acquire_slow(lock);
+    lock_stat_acquired(lock, site, true, tsc_read() - start);
+#else
+    lock_acquire_slow(lock);
+#endif
+}
+
+static inline bool lock_try_acquire_site(lock_t* lock, const char* site)
+{
+    cli_push();
+
+    uint32_t expected = 0;
+    if (atomic_compare_exchange_strong(&lock->value, &expected, LOCK_LOCKED))
+    {
+#if CONFIG_LOCK_STATS
+        lock_stat_acquired(lock, site, false, 0);
+#endif
+        return true;
+    }
+
+    cli_pop();
+    return false;
 }
 
 static inline void lock_release(lock_t* lock)
 {
-    atomic_fetch_add(&lock->nowServing, 1);
+#if CONFIG_LOCK_STATS
+    lock_stat_released(lock);
+#endif
+    atomic_fetch_and(&lock->value, ~LOCK_LOCKED);
 
     cli_pop();
 }
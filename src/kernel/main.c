@@ -14,7 +14,7 @@ void main(boot_info_t* bootInfo)
     log_print("kernel: shell spawn");
 
     const char* argv[] = {"home:/bin/shell", NULL};
-    thread_t* shell = loader_spawn(argv, PRIORITY_MIN + 1);
+    thread_t* shell = loader_spawn(argv, PRIORITY_USER);
     LOG_ASSERT(shell != NULL, "Failed to spawn shell");
 
     sched_push(shell);
@@ -12,16 +12,22 @@ static uint64_t mouse_read(file_t* file, void* buffer, uint64_t count)
     mouse_t* mouse = file->private;
 
     count = ROUND_DOWN(count, sizeof(mouse_event_t));
-    for (uint64_t i = 0; i < count / sizeof(mouse_event_t); i++)
+    uint64_t amount = count / sizeof(mouse_event_t);
+    uint64_t i = 0;
+    while (i < amount)
     {
+        // See kbd_read().
         if (SCHED_BLOCK_LOCK(&mouse->blocker, &mouse->lock, file->pos != mouse->writeIndex) != BLOCK_NORM)
         {
             lock_release(&mouse->lock);
             return i * sizeof(mouse_event_t);
         }
 
-        ((mouse_event_t*)buffer)[i] = mouse->events[file->pos];
-        file->pos = (file->pos + 1) % MOUSE_MAX_EVENT;
+        while (i < amount && file->pos != mouse->writeIndex)
+        {
+            ((mouse_event_t*)buffer)[i++] = mouse->events[file->pos];
+            file->pos = (file->pos + 1) % MOUSE_MAX_EVENT;
+        }
 
         lock_release(&mouse->lock);
     }
@@ -0,0 +1,118 @@
+#include "mutex.h"
+
+#include "log.h"
+#include "smp.h"
+#include "trap.h"
+
+void mutex_init(mutex_t* mutex)
+{
+    atomic_init(&mutex->owner, NULL);
+    atomic_init(&mutex->waiters, 0);
+    blocker_init(&mutex->blocker);
+}
+
+// Only compares pointers, the owner might exit at any time and must not be dereferenced.
+static bool mutex_owner_running(const thread_t* owner)
+{
+    uint8_t cpuAmount = smp_cpu_amount();
+    for (uint8_t id = 0; id < cpuAmount; id++)
+    {
+        if (smp_cpu(id)->sched.runThread == owner)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool mutex_try_take(mutex_t* mutex, thread_t* thread)
+{
+    thread_t* expected = NULL;
+    if (!atomic_compare_exchange_strong(&mutex->owner, &expected, thread))
+    {
+        return false;
+    }
+
+    thread->mutexDepth++;
+    return true;
+}
+
+void mutex_acquire(mutex_t* mutex)
+{
+    thread_t* thread = sched_thread();
+    if (mutex_try_take(mutex, thread))
+    {
+        return;
+    }
+
+    LOG_ASSERT(atomic_load(&mutex->owner) != thread, "mutex already held");
+
+    // An owner that is running will most likely release the mutex sooner than a sleep and wakeup would take.
+    for (uint64_t i = 0; i < MUTEX_SPIN_LIMIT; i++)
+    {
+        thread_t* owner = atomic_load(&mutex->owner);
+        if (owner == NULL)
+        {
+            if (mutex_try_take(mutex, thread))
+            {
+                return;
+            }
+            continue;
+        }
+
+        if (!mutex_owner_running(owner))
+        {
+            break;
+        }
+        asm volatile("pause");
+    }
+
+    // Pairs with the release, either the releaser sees the waiter or the waiter sees the mutex free.
+    atomic_fetch_add(&mutex->waiters, 1);
+    while (1)
+    {
+        uint64_t generation = blocker_generation(&mutex->blocker);
+        if (mutex_try_take(mutex, thread))
+        {
+            break;
+        }
+
+        sched_block_exclusive(&mutex->blocker, generation, NEVER);
+    }
+    atomic_fetch_sub(&mutex->waiters, 1);
+}
+
+bool mutex_try_acquire(mutex_t* mutex)
+{
+    return mutex_try_take(mutex, sched_thread());
+}
+
+void mutex_release(mutex_t* mutex)
+{
+    LOG_ASSERT(atomic_load(&mutex->owner) == sched_thread(), "mutex released by non owner");
+
+    sched_thread()->mutexDepth--;
+    atomic_store(&mutex->owner, NULL);
+    if (atomic_load(&mutex->waiters) != 0)
+    {
+        sched_unblock_one(&mutex->blocker);
+    }
+}
+
+void mutex_acquire_no_preempt(mutex_t* mutex)
+{
+    mutex_acquire(mutex);
+    cli_push();
+}
+
+void mutex_release_no_preempt(mutex_t* mutex)
+{
+    mutex_release(mutex);
+    cli_pop();
+}
+
+bool mutex_held(mutex_t* mutex)
+{
+    return atomic_load(&mutex->owner) == sched_thread();
+}
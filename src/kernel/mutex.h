@@ -0,0 +1,52 @@
+#pragma once
+
+#include "defs.h"
+#include "sched.h"
+#include "thread.h"
+
+// Amount of times a waiter checks a mutex whose owner is running on another cpu before going to sleep.
+#define MUTEX_SPIN_LIMIT 4096
+
+// Sleeping lock for long critical sections, unlike lock_t it leaves interrupts enabled and waiters block once spinning
+// stops being worthwhile. Must only be used where blocking is allowed, never from interrupt handlers.
+typedef struct
+{
+    _Atomic(thread_t*) owner;
+    atomic_uint64_t waiters;
+    blocker_t blocker;
+} mutex_t;
+
+#define MUTEX_GUARD(mutex) \
+    __attribute__((cleanup(mutex_cleanup))) mutex_t* CONCAT(m, __COUNTER__) = (mutex); \
+    mutex_acquire((mutex))
+
+void mutex_init(mutex_t* mutex);
+
+void mutex_acquire(mutex_t* mutex);
+
+bool mutex_try_acquire(mutex_t* mutex);
+
+void mutex_release(mutex_t* mutex);
+
+// Same as mutex_acquire() but the thread can not be preempted until mutex_release_no_preempt(), meant for short
+// sections of normal threads on a mutex that a deadline thread also takes. The section must not block.
+void mutex_acquire_no_preempt(mutex_t* mutex);
+
+void mutex_release_no_preempt(mutex_t* mutex);
+
+// True if the running thread owns the mutex.
+bool mutex_held(mutex_t* mutex);
+
+static inline void mutex_cleanup(mutex_t** mutex)
+{
+    mutex_release(*mutex);
+}
+
+#define MUTEX_GUARD_NO_PREEMPT(mutex) \
+    __attribute__((cleanup(mutex_cleanup_no_preempt))) mutex_t* CONCAT(m, __COUNTER__) = (mutex); \
+    mutex_acquire_no_preempt((mutex))
+
+static inline void mutex_cleanup_no_preempt(mutex_t** mutex)
+{
+    mutex_release_no_preempt(*mutex);
+}
@@ -4,16 +4,83 @@
 #include "pmm.h"
 #include "ring.h"
 #include "sched.h"
+#include "slab.h"
 #include "vfs.h"
 
 #include <stdlib.h>
 #include <sys/math.h>
 
+// The blockers, the waiters and the lock are left in their initial state by every pipe, so they are only set up once
+// per object.
+static void pipe_private_ctor(void* object)
+{
+    pipe_private_t* private = object;
+    blocker_init(&private->readBlocker);
+    blocker_init(&private->writeBlocker);
+    private->readWaiters = (pipe_waiters_t){0};
+    private->writeWaiters = (pipe_waiters_t){0};
+    lock_init(&private->lock);
+}
+
+static slab_cache_t pipeCache = SLAB_CACHE_INIT(pipe_private_t, pipe_private_ctor);
+
 static void pipe_private_free(pipe_private_t* private)
 {
     ring_cleanup(&private->ring);
-    blocker_cleanup(&private->blocker);
-    free(private);
+    blocker_cleanup(&private->readBlocker);
+    blocker_cleanup(&private->writeBlocker);
+    slab_free(&pipeCache, private);
+}
+
+static bool pipe_read_ready(pipe_private_t* private, uint64_t count)
+{
+    return ring_data_length(&private->ring) >= count || private->writeClosed;
+}
+
+static bool pipe_write_ready(pipe_private_t* private, uint64_t count)
+{
+    return ring_free_length(&private->ring) >= count || private->readClosed;
+}
+
+// Same as SCHED_BLOCK_LOCK_EXCLUSIVE but counts the thread in waiters while it sleeps.
+static block_result_t pipe_block(pipe_private_t* private, blocker_t* blocker, pipe_waiters_t* waiters, uint64_t count,
+    bool (*ready)(pipe_private_t*, uint64_t))
+{
+    block_result_t result = BLOCK_NORM;
+    lock_acquire(&private->lock);
+    while (result == BLOCK_NORM)
+    {
+        uint64_t generation = blocker_generation(blocker);
+        if (ready(private, count))
+        {
+            break;
+        }
+
+        if (waiters->amount == 0)
+        {
+            waiters->count = count;
+            waiters->mixed = false;
+        }
+        else if (waiters->count != count)
+        {
+            waiters->mixed = true;
+        }
+        waiters->amount++;
+
+        lock_release(&private->lock);
+        result = sched_block_exclusive(blocker, generation, NEVER);
+        lock_acquire(&private->lock);
+
+        waiters->amount--;
+    }
+
+    return result;
+}
+
+// Amount of waiters to wake after the lock is released, read while it is held.
+static uint64_t pipe_wake_amount(const pipe_waiters_t* waiters)
+{
+    return waiters->mixed ? UINT64_MAX : 1;
 }
 
 static uint64_t pipe_read(file_t* file, void* buffer, uint64_t count)
@@ -25,10 +92,14 @@ static uint64_t pipe_read(file_t* file, void* buffer, uint64_t count)
         return ERROR(EINVAL);
     }
 
-    if (SCHED_BLOCK_LOCK(&private->blocker, &private->lock, ring_data_length(&private->ring) >= count || private->writeClosed) !=
-        BLOCK_NORM)
+    // Readers and writers wait exclusively on their own blocker so that every read or write wakes at most one thread on
+    // the other side, a woken thread that leaves something behind passes the wake on to the next one. Everyone is woken
+    // instead while the waiters do not all wait for the same amount, see pipe_waiters_t.
+    if (pipe_block(private, &private->readBlocker, &private->readWaiters, count, pipe_read_ready) != BLOCK_NORM)
     {
+        uint64_t readWake = pipe_wake_amount(&private->readWaiters);
         lock_release(&private->lock);
+        sched_unblock_n(&private->readBlocker, readWake);
         return 0;
     }
 
@@ -38,9 +109,16 @@ static uint64_t pipe_read(file_t* file, void* buffer, uint64_t count)
     }
 
     LOG_ASSERT(ring_read(&private->ring, buffer, count) != ERR, "ring_read");
+    bool dataLeft = ring_data_length(&private->ring) != 0 || private->writeClosed;
+    uint64_t writeWake = pipe_wake_amount(&private->writeWaiters);
+    uint64_t readWake = pipe_wake_amount(&private->readWaiters);
 
     lock_release(&private->lock);
-    sched_unblock(&private->blocker);
+    sched_unblock_n(&private->writeBlocker, writeWake);
+    if (dataLeft)
+    {
+        sched_unblock_n(&private->readBlocker, readWake);
+    }
     return count;
 }
 
@@ -53,24 +131,32 @@ static uint64_t pipe_write(file_t* file, const void* buffer, uint64_t count)
         return ERROR(EINVAL);
     }
 
-    if (SCHED_BLOCK_LOCK(&private->blocker, &private->lock, ring_free_length(&private->ring) >= count || private->readClosed) !=
-        BLOCK_NORM)
+    if (pipe_block(private, &private->writeBlocker, &private->writeWaiters, count, pipe_write_ready) != BLOCK_NORM)
     {
+        uint64_t writeWake = pipe_wake_amount(&private->writeWaiters);
         lock_release(&private->lock);
+        sched_unblock_n(&private->writeBlocker, writeWake);
         return 0;
     }
 
     if (private->readClosed)
     {
         lock_release(&private->lock);
-        sched_unblock(&private->blocker);
+        sched_unblock(&private->writeBlocker);
         return ERROR(EPIPE);
     }
 
     LOG_ASSERT(ring_write(&private->ring, buffer, count) != ERR, "ring_write");
+    bool spaceLeft = ring_free_length(&private->ring) != 0;
+    uint64_t readWake = pipe_wake_amount(&private->readWaiters);
+    uint64_t writeWake = pipe_wake_amount(&private->writeWaiters);
 
     lock_release(&private->lock);
-    sched_unblock(&private->blocker);
+    sched_unblock_n(&private->readBlocker, readWake);
+    if (spaceLeft)
+    {
+        sched_unblock_n(&private->writeBlocker, writeWake);
+    }
     return count;
 }
 
@@ -103,6 +189,8 @@ static void pipe_read_cleanup(file_t* file)
         return;
     }
 
+    // Unblocked while the lock is held as the write end may free the pipe as soon as it is released.
+    sched_unblock(&private->writeBlocker);
     lock_release(&private->lock);
 }
 
@@ -119,6 +207,8 @@ static void pipe_write_cleanup(file_t* file)
         return;
     }
 
+    // Unblocked while the lock is held as the read end may free the pipe as soon as it is released.
+    sched_unblock(&private->readBlocker);
     lock_release(&private->lock);
 }
 
@@ -151,7 +241,7 @@ uint64_t pipe_init(pipe_file_t* pipe)
     }
     pipe->write->ops = &writeOps;
 
-    pipe_private_t* private = malloc(sizeof(pipe_private_t));
+    pipe_private_t* private = slab_alloc(&pipeCache);
     if (private == NULL)
     {
         file_deref(pipe->read);
@@ -161,8 +251,6 @@ uint64_t pipe_init(pipe_file_t* pipe)
     ring_init(&private->ring);
     private->readClosed = false;
     private->writeClosed = false;
-    blocker_init(&private->blocker);
-    lock_init(&private->lock);
 
     pipe->read->private = private;
     pipe->write->private = private;
@@ -4,12 +4,24 @@
 #include "sched.h"
 #include "vfs.h"
 
+// Waking one waiter is only enough while every waiter on a side waits for the same amount, a waiter that wakes and
+// still finds too little would otherwise go back to sleep with the wake that another one could have used.
+typedef struct
+{
+    uint64_t amount;
+    uint64_t count; // Amount of bytes waited for by the first waiter
+    bool mixed;     // Some waiter waits for another amount, stays set until there are no waiters
+} pipe_waiters_t;
+
 typedef struct
 {
     ring_t ring;
     bool readClosed;
     bool writeClosed;
-    blocker_t blocker;
+    blocker_t readBlocker;
+    blocker_t writeBlocker;
+    pipe_waiters_t readWaiters;
+    pipe_waiters_t writeWaiters;
     lock_t lock;
 } pipe_private_t;
 
@@ -43,7 +43,7 @@ static pml_t* pml_get_or_allocate(pml_t* table, uint64_t index, uint64_t flags)
     }
 }
 
-static void pml_free_level(pml_t* table, int64_t level)
+static void pml_free_level(pml_t* table, int64_t level, pmm_batch_t* batch)
 {
     if (level < 0)
     {
@@ -58,13 +58,18 @@ static void pml_free_level(pml_t* table, int64_t level)
             continue;
         }
 
-        if (level != 1 || (entry & PAGE_OWNED))
+        // Mapped pages are freed directly instead of being walked like another level.
+        if (level != 1)
         {
-            pml_free_level(PAGE_ENTRY_GET_ADDRESS(entry), level - 1);
+            pml_free_level(PAGE_ENTRY_GET_ADDRESS(entry), level - 1, batch);
+        }
+        else if (entry & PAGE_OWNED)
+        {
+            pmm_batch_add(batch, PAGE_ENTRY_GET_ADDRESS(entry));
         }
     }
 
-    pmm_free(table);
+    pmm_batch_add(batch, table);
 }
 
 pml_t* pml_new(void)
@@ -78,7 +83,10 @@ pml_t* pml_new(void)
 void pml_free(pml_t* table)
 {
     // Will also free any pages mapped in the page table
-    pml_free_level(table, 4);
+    pmm_batch_t batch;
+    pmm_batch_init(&batch);
+    pml_free_level(table, 4, &batch);
+    pmm_batch_flush(&batch);
 }
 
 void pml_load(pml_t* table)
@@ -155,8 +163,9 @@ void pml_map(pml_t* table, void* virtAddr, void* physAddr, uint64_t pageAmount,
     }
 }
 
-void pml_unmap(pml_t* table, void* virtAddr, uint64_t pageAmount)
+uint64_t pml_unmap(pml_t* table, void* virtAddr, uint64_t pageAmount, void** ownedPages)
 {
+    uint64_t ownedAmount = 0;
     for (uint64_t i = 0; i < pageAmount; i++)
     {
         pml_t* level3 = pml_get(table, PML_GET_INDEX(virtAddr, 4));
@@ -166,7 +175,14 @@ void pml_unmap(pml_t* table, void* virtAddr, uint64_t pageAmount)
 
         if (*entry & PAGE_OWNED)
         {
-            pmm_free(PAGE_ENTRY_GET_ADDRESS(*entry));
+            if (ownedPages != NULL)
+            {
+                ownedPages[ownedAmount++] = PAGE_ENTRY_GET_ADDRESS(*entry);
+            }
+            else
+            {
+                pmm_free(PAGE_ENTRY_GET_ADDRESS(*entry));
+            }
         }
         *entry = 0;
 
@@ -174,6 +190,8 @@ void pml_unmap(pml_t* table, void* virtAddr, uint64_t pageAmount)
 
         virtAddr = (void*)((uint64_t)virtAddr + PAGE_SIZE);
     }
+
+    return ownedAmount;
 }
 
 void pml_change_flags(pml_t* table, void* virtAddr, uint64_t pageAmount, uint64_t flags)
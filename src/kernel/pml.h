@@ -20,7 +20,7 @@
 #define PAGE_ENTRY_AMOUNT 512
 #define PAGE_ENTRY_GET_ADDRESS(entry) VMM_LOWER_TO_HIGHER((entry) & 0x000FFFFFFFFFF000)
 
-#define PAGE_INVALIDATE(address) asm volatile("invlpg %0" : : "m"(address))
+#define PAGE_INVALIDATE(address) asm volatile("invlpg (%0)" : : "r"(address) : "memory")
 
 /*#define PML_GET_INDEX(address, level) \
     (((uint64_t)(address) & ((uint64_t)0x1FF << (((level) - 1) * 9 + 12))) >> (((level) - 1) * 9 + 12))*/
@@ -45,6 +45,8 @@ bool pml_mapped(pml_t* table, const void* virtAddr, uint64_t pageAmount);
 
 void pml_map(pml_t* table, void* virtAddr, void* physAddr, uint64_t pageAmount, uint64_t flags);
 
-void pml_unmap(pml_t* table, void* virtAddr, uint64_t pageAmount);
+// If ownedPages is not NULL owned pages are stored there instead of being freed, so that they can be freed once no cpu
+// can still hold a translation to them. Returns the amount of pages stored.
+uint64_t pml_unmap(pml_t* table, void* virtAddr, uint64_t pageAmount, void** ownedPages);
 
 void pml_change_flags(pml_t* table, void* virtAddr, uint64_t pageAmount, uint64_t flags);
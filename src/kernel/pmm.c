@@ -2,6 +2,7 @@
 
 #include <stddef.h>
 #include <string.h>
+#include <sys/heap.h>
 #include <sys/math.h>
 
 #include <bootloader/boot_info.h>
@@ -9,6 +10,8 @@
 #include "config.h"
 #include "lock.h"
 #include "log.h"
+#include "smp.h"
+#include "sysfs.h"
 #include "sys/proc.h"
 #include "utils.h"
 #include "vmm.h"
@@ -31,7 +34,7 @@ static const char* efiMemTypeToString[] = {
     "persistent memory",
 };
 
-static page_stack_t stack;
+static page_buddy_t buddy;
 static page_bitmap_t bitmap;
 
 static uint64_t pageAmount = 0;
@@ -39,59 +42,105 @@ static uint64_t freePageAmount = 0;
 
 static lock_t lock;
 
-static void page_stack_init(void)
+static uint64_t page_buddy_index(const void* address)
 {
-    stack.last = NULL;
-    stack.index = 0;
+    return ((uint64_t)address - VMM_HIGHER_HALF_BASE) / PAGE_SIZE;
 }
 
-static void* page_stack_alloc(void)
+static void* page_buddy_address(uint64_t index)
 {
-    void* address;
-    if (stack.index == 0)
+    return (void*)(index * PAGE_SIZE + VMM_HIGHER_HALF_BASE);
+}
+
+// Free blocks hold their own list entry.
+static void page_buddy_push(uint64_t index, uint64_t order)
+{
+    buddy.orders[index] = order + 1;
+    list_entry_t* entry = page_buddy_address(index);
+    list_entry_init(entry);
+    list_push(&buddy.freeLists[order], entry);
+}
+
+static void page_buddy_remove(uint64_t index)
+{
+    buddy.orders[index] = 0;
+    list_remove(page_buddy_address(index));
+}
+
+static void* page_buddy_alloc(uint64_t order)
+{
+    uint64_t current = order;
+    while (current <= PMM_ORDER_MAX && list_empty(&buddy.freeLists[current]))
     {
-        if (stack.last == NULL)
-        {
-            return NULL;
-        }
-        else
-        {
-            address = stack.last;
-            stack.last = stack.last->prev;
-            stack.index = PAGE_BUFFER_MAX - 1;
-        }
+        current++;
     }
-    else
+
+    if (current > PMM_ORDER_MAX)
     {
-        address = stack.last->pages[--stack.index];
+        return NULL;
     }
 
-    freePageAmount--;
+    list_entry_t* entry = list_pop(&buddy.freeLists[current]);
+    uint64_t index = page_buddy_index(entry);
+    buddy.orders[index] = 0;
 
-    return address;
+    // The upper halves of a larger block go back to the free lists.
+    while (current > order)
+    {
+        current--;
+        page_buddy_push(index + (1ULL << current), current);
+    }
+
+    freePageAmount -= 1ULL << order;
+    return entry;
 }
 
-static void page_stack_free(void* address)
+static void page_buddy_free(uint64_t index, uint64_t order)
 {
-    freePageAmount++;
+    LOG_ASSERT(index < buddy.pageMax && buddy.orders[index] == 0, "invalid page free");
+    freePageAmount += 1ULL << order;
 
-    if (stack.last == NULL)
+    while (order < PMM_ORDER_MAX)
     {
-        stack.last = address;
-        stack.last->prev = NULL;
-        stack.index = 0;
+        uint64_t buddyIndex = index ^ (1ULL << order);
+        if (buddyIndex >= buddy.pageMax || buddy.orders[buddyIndex] != order + 1)
+        {
+            break;
+        }
+
+        page_buddy_remove(buddyIndex);
+        index &= ~(1ULL << order);
+        order++;
     }
-    else if (stack.index == PAGE_BUFFER_MAX)
+
+    page_buddy_push(index, order);
+}
+
+// Frees a run of pages as the largest aligned blocks that fit in it.
+static void page_buddy_free_range(uint64_t index, uint64_t count)
+{
+    uint64_t end = index + count;
+    while (index < end)
     {
-        page_buffer_t* next = address;
-        next->prev = stack.last;
-        stack.last = next;
-        stack.index = 0;
+        uint64_t order = index == 0 ? PMM_ORDER_MAX : MIN((uint64_t)__builtin_ctzll(index), PMM_ORDER_MAX);
+        while (index + (1ULL << order) > end)
+        {
+            order--;
+        }
+
+        page_buddy_free(index, order);
+        index += 1ULL << order;
     }
-    else
+}
+
+static uint64_t page_buddy_order(uint64_t count)
+{
+    uint64_t order = 0;
+    while ((1ULL << order) < count)
     {
-        stack.last->pages[stack.index++] = address;
+        order++;
     }
+    return order;
 }
 
 static void page_bitmap_init(void)
@@ -161,7 +210,7 @@ static void pmm_free_unlocked(void* address)
 {
     if ((uint64_t)address >= PMM_MAX_SPECIAL_ADDR + VMM_HIGHER_HALF_BASE)
     {
-        page_stack_free(address);
+        page_buddy_free(page_buddy_index(address), 0);
     }
     else
     {
@@ -171,21 +220,79 @@ static void pmm_free_unlocked(void* address)
 
 static void pmm_free_pages_unlocked(void* address, uint64_t count)
 {
-    for (uint64_t i = 0; i < count; i++)
+    uint64_t special = 0;
+    while (special < count && (uint64_t)address + special * PAGE_SIZE < PMM_MAX_SPECIAL_ADDR + VMM_HIGHER_HALF_BASE)
     {
-        pmm_free_unlocked((void*)((uint64_t)address + i * PAGE_SIZE));
+        page_bitmap_free((void*)((uint64_t)address + special * PAGE_SIZE));
+        special++;
+    }
+
+    if (special < count)
+    {
+        page_buddy_free_range(page_buddy_index(address) + special, count - special);
     }
 }
 
+static bool pmm_is_freeable(const efi_mem_desc_t* desc)
+{
+    return EFI_IS_MEMORY_AVAIL(desc->type) || desc->type == EFI_LOADER_DATA;
+}
+
+// The order of every page up to the end of the highest memory that can ever be freed is tracked in one byte per page,
+// stored at the start of the first conventional memory above the special range that is large enough.
+static void pmm_buddy_init(efi_mem_map_t* memoryMap, const efi_mem_desc_t** ordersDesc, uint64_t* ordersPages)
+{
+    for (uint64_t i = 0; i <= PMM_ORDER_MAX; i++)
+    {
+        list_init(&buddy.freeLists[i]);
+    }
+
+    buddy.pageMax = 0;
+    for (uint64_t i = 0; i < memoryMap->descriptorAmount; i++)
+    {
+        const efi_mem_desc_t* desc = EFI_MEMORY_MAP_GET_DESCRIPTOR(memoryMap, i);
+        if (pmm_is_freeable(desc))
+        {
+            buddy.pageMax = MAX(buddy.pageMax, (uint64_t)desc->physicalStart / PAGE_SIZE + desc->amountOfPages);
+        }
+    }
+
+    *ordersPages = ROUND_UP(buddy.pageMax, PAGE_SIZE) / PAGE_SIZE;
+    *ordersDesc = NULL;
+    for (uint64_t i = 0; i < memoryMap->descriptorAmount; i++)
+    {
+        const efi_mem_desc_t* desc = EFI_MEMORY_MAP_GET_DESCRIPTOR(memoryMap, i);
+        if (desc->type == EFI_CONVENTIONAL_MEMORY && (uint64_t)desc->physicalStart >= PMM_MAX_SPECIAL_ADDR &&
+            desc->amountOfPages >= *ordersPages)
+        {
+            *ordersDesc = desc;
+            break;
+        }
+    }
+    LOG_ASSERT(*ordersDesc != NULL, "no memory for page orders");
+
+    buddy.orders = VMM_LOWER_TO_HIGHER((*ordersDesc)->physicalStart);
+    memset(buddy.orders, 0, buddy.pageMax);
+}
+
 static void pmm_load_memory(efi_mem_map_t* memoryMap)
 {
     log_print("UEFI-provided memory map: ");
 
+    const efi_mem_desc_t* ordersDesc;
+    uint64_t ordersPages;
+    pmm_buddy_init(memoryMap, &ordersDesc, &ordersPages);
+
     for (uint64_t i = 0; i < memoryMap->descriptorAmount; i++)
     {
         const efi_mem_desc_t* desc = EFI_MEMORY_MAP_GET_DESCRIPTOR(memoryMap, i);
 
-        if (EFI_IS_MEMORY_AVAIL(desc->type))
+        if (desc == ordersDesc)
+        {
+            pmm_free_pages_unlocked(VMM_LOWER_TO_HIGHER(desc->physicalStart + ordersPages * PAGE_SIZE),
+                desc->amountOfPages - ordersPages);
+        }
+        else if (EFI_IS_MEMORY_AVAIL(desc->type))
         {
             pmm_free_pages_unlocked(VMM_LOWER_TO_HIGHER(desc->physicalStart), desc->amountOfPages);
         }
@@ -200,20 +307,93 @@ void pmm_init(efi_mem_map_t* memoryMap)
 {
     lock_init(&lock);
 
-    page_stack_init();
     page_bitmap_init();
 
     pmm_load_memory(memoryMap);
 }
 
-void* pmm_alloc(void)
+void pmm_cache_init(pmm_cache_t* cache)
+{
+    cache->count = 0;
+    cache->allocs = 0;
+    cache->frees = 0;
+    cache->refills = 0;
+    cache->drains = 0;
+}
+
+static void pmm_cache_refill(pmm_cache_t* cache)
+{
+    LOCK_GUARD(&lock);
+    while (cache->count < PMM_CACHE_BATCH)
+    {
+        void* address = page_buddy_alloc(0);
+        if (address == NULL)
+        {
+            break;
+        }
+        cache->pages[cache->count++] = address;
+    }
+    cache->refills++;
+}
+
+static void pmm_cache_drain(pmm_cache_t* cache)
 {
     LOCK_GUARD(&lock);
-    void* address = page_stack_alloc();
+    for (uint64_t i = 0; i < PMM_CACHE_BATCH; i++)
+    {
+        page_buddy_free(page_buddy_index(cache->pages[--cache->count]), 0);
+    }
+    cache->drains++;
+}
+
+void* pmm_alloc(void)
+{
+    // The caches are only used once every cpu is running.
+    if (!smp_initialized())
+    {
+        LOCK_GUARD(&lock);
+        void* address = page_buddy_alloc(0);
+        LOG_ASSERT(address != NULL, "no more memory");
+        return address;
+    }
+
+    pmm_cache_t* cache = &smp_self()->pageCache;
+    if (cache->count == 0)
+    {
+        pmm_cache_refill(cache);
+    }
+    void* address = cache->count != 0 ? cache->pages[--cache->count] : NULL;
+    cache->allocs++;
+    smp_put();
+
     LOG_ASSERT(address != NULL, "no more memory");
     return address;
 }
 
+void* pmm_alloc_pages(uint64_t count)
+{
+    uint64_t order = page_buddy_order(count);
+    if (count == 0 || order > PMM_ORDER_MAX)
+    {
+        return NULL;
+    }
+
+    LOCK_GUARD(&lock);
+    void* address = page_buddy_alloc(order);
+    if (address == NULL)
+    {
+        return NULL;
+    }
+
+    // Only the requested pages stay allocated, the rest of the block is freed again.
+    uint64_t blockPages = 1ULL << order;
+    if (count < blockPages)
+    {
+        page_buddy_free_range(page_buddy_index(address) + count, blockPages - count);
+    }
+    return address;
+}
+
 void* pmm_alloc_special(uint64_t count, uintptr_t maxAddr, uint64_t alignment)
 {
     LOCK_GUARD(&lock);
@@ -225,8 +405,21 @@ void* pmm_alloc_special(uint64_t count, uintptr_t maxAddr, uint64_t alignment)
 void pmm_free(void* address)
 {
     address = (void*)ROUND_DOWN(address, PAGE_SIZE);
-    LOCK_GUARD(&lock);
-    pmm_free_unlocked(address);
+    if (!smp_initialized() || (uint64_t)address < PMM_MAX_SPECIAL_ADDR + VMM_HIGHER_HALF_BASE)
+    {
+        LOCK_GUARD(&lock);
+        pmm_free_unlocked(address);
+        return;
+    }
+
+    pmm_cache_t* cache = &smp_self()->pageCache;
+    if (cache->count == PMM_CACHE_SIZE)
+    {
+        pmm_cache_drain(cache);
+    }
+    cache->pages[cache->count++] = address;
+    cache->frees++;
+    smp_put();
 }
 
 void pmm_free_pages(void* address, uint64_t count)
@@ -236,14 +429,106 @@ void pmm_free_pages(void* address, uint64_t count)
     pmm_free_pages_unlocked(address, count);
 }
 
+void pmm_batch_init(pmm_batch_t* batch)
+{
+    batch->count = 0;
+}
+
+void pmm_batch_add(pmm_batch_t* batch, void* address)
+{
+    batch->pages[batch->count++] = (void*)ROUND_DOWN(address, PAGE_SIZE);
+    if (batch->count == PMM_BATCH_MAX)
+    {
+        pmm_batch_flush(batch);
+    }
+}
+
+void pmm_batch_flush(pmm_batch_t* batch)
+{
+    if (batch->count == 0)
+    {
+        return;
+    }
+
+    LOCK_GUARD(&lock);
+    for (uint64_t i = 0; i < batch->count; i++)
+    {
+        pmm_free_unlocked(batch->pages[i]);
+    }
+    batch->count = 0;
+}
+
+static void pmm_buddy_print(sysfs_text_t* text, void* private)
+{
+    // Printing can allocate, so the counts are taken before.
+    uint64_t amounts[PMM_ORDER_MAX + 1] = {0};
+    lock_acquire(&lock);
+    for (uint64_t i = 0; i <= PMM_ORDER_MAX; i++)
+    {
+        list_entry_t* entry;
+        LIST_FOR_EACH(entry, &buddy.freeLists[i])
+        {
+            amounts[i]++;
+        }
+    }
+    lock_release(&lock);
+
+    sysfs_text_print(text, "order free_blocks\n");
+    for (uint64_t i = 0; i <= PMM_ORDER_MAX; i++)
+    {
+        sysfs_text_print(text, "%d %d\n", i, amounts[i]);
+    }
+}
+
+static void pmm_cache_print(sysfs_text_t* text, void* private)
+{
+    sysfs_text_print(text, "cpu cached allocs frees refills drains\n");
+
+    uint8_t cpuAmount = smp_cpu_amount();
+    for (uint8_t id = 0; id < cpuAmount; id++)
+    {
+        const pmm_cache_t* cache = &smp_cpu(id)->pageCache;
+        sysfs_text_print(text, "%d %d %d %d %d %d\n", (uint64_t)id, cache->count, cache->allocs, cache->frees,
+            cache->refills, cache->drains);
+    }
+}
+
+// The kernel heap takes its memory from here.
+static void pmm_heap_print(sysfs_text_t* text, void* private)
+{
+    heap_stats_t stats;
+    heap_stats(&stats);
+
+    sysfs_text_print(text, "mapped used free free_blocks largest_free arenas large_blocks allocs frees released\n");
+    sysfs_text_print(text, "%d %d %d %d %d %d %d %d %d %d\n", stats.mapped, stats.used, stats.free, stats.freeBlocks,
+        stats.largestFree, stats.arenas, stats.largeBlocks, stats.allocs, stats.frees, stats.released);
+}
+
+void pmm_expose_stats(void)
+{
+    sysfs_expose_text("/stats", "buddy", pmm_buddy_print, NULL);
+    sysfs_expose_text("/stats", "pagecache", pmm_cache_print, NULL);
+    sysfs_expose_text("/stats", "heap", pmm_heap_print, NULL);
+}
+
 uint64_t pmm_total_amount(void)
 {
     return pageAmount;
 }
 
+// Pages in the per cpu caches are free as well.
 uint64_t pmm_free_amount(void)
 {
-    return freePageAmount;
+    uint64_t amount = freePageAmount;
+    if (smp_initialized())
+    {
+        uint8_t cpuAmount = smp_cpu_amount();
+        for (uint8_t id = 0; id < cpuAmount; id++)
+        {
+            amount += smp_cpu(id)->pageCache.count;
+        }
+    }
+    return amount;
 }
 
 uint64_t pmm_reserved_amount(void)
@@ -4,23 +4,20 @@
 
 #include <bootloader/boot_info.h>
 
+#include <sys/list.h>
 #include <sys/proc.h>
 
 #define PMM_MAX_SPECIAL_ADDR (0x100000)
 
-typedef struct page_buffer
-{
-    struct page_buffer* prev;
-    void* pages[];
-} page_buffer_t;
+// Blocks of the buddy allocator are 2^order pages, from a single page up to 4 MiB.
+#define PMM_ORDER_MAX 10
 
-typedef struct page_stack
+typedef struct page_buddy
 {
-    page_buffer_t* last;
-    uint64_t index;
-} page_stack_t;
-
-#define PAGE_BUFFER_MAX ((PAGE_SIZE - sizeof(void*)) / sizeof(void*))
+    list_t freeLists[PMM_ORDER_MAX + 1];
+    uint8_t* orders; // Per page, the order + 1 of the free block starting at the page or 0
+    uint64_t pageMax; // Pages tracked by orders
+} page_buddy_t;
 
 typedef struct page_bitmap
 {
@@ -28,16 +25,58 @@ typedef struct page_bitmap
     uint64_t firstFreeIndex;
 } page_bitmap_t;
 
+// Per cpu magazine of free pages in front of the buddy allocator. An empty magazine is refilled with PMM_CACHE_BATCH
+// pages and a full one drained down to PMM_CACHE_SIZE - PMM_CACHE_BATCH, so most allocations and frees never take the
+// pmm lock.
+#define PMM_CACHE_SIZE 64
+#define PMM_CACHE_BATCH 32
+
+typedef struct
+{
+    void* pages[PMM_CACHE_SIZE];
+    uint64_t count;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t refills;
+    uint64_t drains;
+} pmm_cache_t;
+
+// Pages queued with pmm_batch_add() are freed together under one acquisition of the pmm lock.
+#define PMM_BATCH_MAX 32
+
+typedef struct
+{
+    void* pages[PMM_BATCH_MAX];
+    uint64_t count;
+} pmm_batch_t;
+
 void pmm_init(efi_mem_map_t* memoryMap);
 
+void pmm_cache_init(pmm_cache_t* cache);
+
 void* pmm_alloc(void);
 
+// Allocates count physically contiguous pages, returns NULL if no run is large enough. A power of two count is also
+// aligned to its own size. Freed with pmm_free_pages().
+void* pmm_alloc_pages(uint64_t count);
+
 void* pmm_alloc_special(uint64_t count, uintptr_t maxAddr, uint64_t alignment);
 
 void pmm_free(void* address);
 
 void pmm_free_pages(void* address, uint64_t count);
 
+// Exposes sys:/stats/buddy, the amount of free blocks of every order, sys:/stats/pagecache and sys:/stats/heap, the
+// state of the kernel heap.
+void pmm_expose_stats(void);
+
+void pmm_batch_init(pmm_batch_t* batch);
+
+// Queues a page to be freed, the batch is flushed once it is full.
+void pmm_batch_add(pmm_batch_t* batch, void* address);
+
+void pmm_batch_flush(pmm_batch_t* batch);
+
 uint64_t pmm_total_amount(void);
 
 uint64_t pmm_free_amount(void);
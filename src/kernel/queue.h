@@ -40,6 +40,36 @@ static inline void* queue_pop(queue_t* queue)
     return list_pop(&queue->list);
 }
 
+// Pops the first element for which predicate returns true.
+static inline void* queue_pop_if(queue_t* queue, bool (*predicate)(void*, void*), void* private)
+{
+    LOCK_GUARD(&queue->lock);
+
+    list_entry_t* elem;
+    LIST_FOR_EACH(elem, &queue->list)
+    {
+        if (predicate(elem, private))
+        {
+            queue->length--;
+            list_remove(elem);
+            return elem;
+        }
+    }
+
+    return NULL;
+}
+
+// Moves every element of src to the end of dest, no other code may hold the locks of two queues at once.
+static inline void queue_splice(queue_t* dest, queue_t* src)
+{
+    LOCK_GUARD(&dest->lock);
+    LOCK_GUARD(&src->lock);
+
+    dest->length += src->length;
+    src->length = 0;
+    list_splice(&dest->list, &src->list);
+}
+
 static inline uint64_t queue_length(const queue_t* queue)
 {
     return queue->length;
@@ -10,20 +10,37 @@
 #define XCR0_ZMM16_32_ENABLE (1 << 7)
 
 #define MSR_LAPIC 0x1B
-#define MSR_CPU_ID 0xC0000103 // IA32_TSC_AUX
+#define MSR_EFER 0xC0000080
+#define MSR_STAR 0xC0000081
+#define MSR_LSTAR 0xC0000082
+#define MSR_SYSCALL_FLAG_MASK 0xC0000084
+#define MSR_FS_BASE 0xC0000100
+#define MSR_GS_BASE 0xC0000101
+#define MSR_KERNEL_GS_BASE 0xC0000102
+
+#define EFER_SYSCALL_ENABLE (1 << 0)
 
 #define RFLAGS_ALWAYS_SET (1 << 1)
+#define RFLAGS_TRAP (1 << 8)
 #define RFLAGS_INTERRUPT_ENABLE (1 << 9)
+#define RFLAGS_DIRECTION (1 << 10)
 
 #define CR0_MONITOR_CO_PROCESSOR (1 << 1)
 #define CR0_EMULATION (1 << 2)
+#define CR0_TASK_SWITCHED (1 << 3)
 #define CR0_NUMERIC_ERROR_ENABLE (1 << 5)
 
 #define CR4_PAGE_GLOBAL_ENABLE (1 << 7)
 #define CR4_FXSR_ENABLE (1 << 9)
 #define CR4_SIMD_EXCEPTION (1 << 10)
+#define CR4_PCID_ENABLE (1 << 17)
 #define CR4_XSAVE_ENABLE (1 << 18)
 
+#define CR3_PCID_MASK 0xFFF
+#define CR3_NO_FLUSH (1ULL << 63)
+
+#define INVPCID_SINGLE_CONTEXT 1
+
 static inline void xcr0_write(uint32_t xcr, uint64_t value)
 {
     uint32_t eax = (uint32_t)value;
@@ -82,6 +99,24 @@ static inline void cr3_write(uint64_t value)
     asm volatile("mov %0, %%cr3" : : "r"(value));
 }
 
+static inline void invpcid(uint64_t type, uint64_t pcid, uint64_t address)
+{
+    struct
+    {
+        uint64_t pcid;
+        uint64_t address;
+    } descriptor = {.pcid = pcid, .address = address};
+    asm volatile("invpcid %0, %1" : : "m"(descriptor), "r"(type) : "memory");
+}
+
+static inline uint64_t tsc_read(void)
+{
+    uint32_t low;
+    uint32_t high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
 static inline uint64_t cr2_read()
 {
     uint64_t cr2;
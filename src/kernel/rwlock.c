@@ -0,0 +1,35 @@
+#include "rwlock.h"
+
+void rwlock_read_acquire_slow(rwlock_t* lock)
+{
+    // Back out and wait in line behind any writer, a writer holds waitLock from the moment it starts waiting until it
+    // has the lock so once waitLock is ours the only thing left to wait for is a writer that is still inside.
+    atomic_fetch_sub(&lock->value, RWLOCK_READER);
+
+    lock_acquire(&lock->waitLock);
+    atomic_fetch_add(&lock->value, RWLOCK_READER);
+    while (atomic_load(&lock->value) & RWLOCK_WRITE_LOCKED)
+    {
+        asm volatile("pause");
+    }
+    lock_release(&lock->waitLock);
+}
+
+void rwlock_write_acquire_slow(rwlock_t* lock)
+{
+    lock_acquire(&lock->waitLock);
+
+    // Stops new readers, then waits for the current ones to leave.
+    atomic_fetch_or(&lock->value, RWLOCK_WRITE_WAITING);
+    while (1)
+    {
+        uint32_t expected = RWLOCK_WRITE_WAITING;
+        if (atomic_compare_exchange_weak(&lock->value, &expected, RWLOCK_WRITE_LOCKED))
+        {
+            break;
+        }
+        asm volatile("pause");
+    }
+
+    lock_release(&lock->waitLock);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdatomic.h>
+
+#include "defs.h"
+#include "lock.h"
+#include "trap.h"
+
+#define RWLOCK_WRITE_LOCKED (1 << 0)
+#define RWLOCK_WRITE_WAITING (1 << 1)
+#define RWLOCK_WRITER_MASK (RWLOCK_WRITE_LOCKED | RWLOCK_WRITE_WAITING)
+#define RWLOCK_READER (1 << 2)
+
+// Reader writer spinlock for read mostly data, readers share the lock while a writer is exclusive. A waiting writer
+// stops new readers from entering so that a steady stream of readers can not starve it, and contending cpus wait in
+// line on waitLock instead of all spinning on value.
+typedef struct
+{
+    atomic_uint32_t value; // Reader count times RWLOCK_READER and the writer bits
+    lock_t waitLock;
+} rwlock_t;
+
+#define RWLOCK_READ_GUARD(lock) \
+    __attribute__((cleanup(rwlock_read_cleanup))) rwlock_t* CONCAT(l, __COUNTER__) = (lock); \
+    rwlock_read_acquire((lock))
+
+#define RWLOCK_WRITE_GUARD(lock) \
+    __attribute__((cleanup(rwlock_write_cleanup))) rwlock_t* CONCAT(l, __COUNTER__) = (lock); \
+    rwlock_write_acquire((lock))
+
+void rwlock_read_acquire_slow(rwlock_t* lock);
+
+void rwlock_write_acquire_slow(rwlock_t* lock);
+
+static inline void rwlock_init(rwlock_t* lock)
+{
+    atomic_init(&lock->value, 0);
+    lock_init(&lock->waitLock);
+}
+
+static inline void rwlock_read_acquire(rwlock_t* lock)
+{
+    cli_push();
+
+    if (atomic_fetch_add(&lock->value, RWLOCK_READER) & RWLOCK_WRITER_MASK)
+    {
+        rwlock_read_acquire_slow(lock);
+    }
+}
+
+static inline void rwlock_read_release(rwlock_t* lock)
+{
+    atomic_fetch_sub(&lock->value, RWLOCK_READER);
+
+    cli_pop();
+}
+
+static inline void rwlock_write_acquire(rwlock_t* lock)
+{
+    cli_push();
+
+    uint32_t expected = 0;
+    if (!atomic_compare_exchange_strong(&lock->value, &expected, RWLOCK_WRITE_LOCKED))
+    {
+        rwlock_write_acquire_slow(lock);
+    }
+}
+
+static inline void rwlock_write_release(rwlock_t* lock)
+{
+    atomic_fetch_sub(&lock->value, RWLOCK_WRITE_LOCKED);
+
+    cli_pop();
+}
+
+static inline void rwlock_read_cleanup(rwlock_t** lock)
+{
+    rwlock_read_release(*lock);
+}
+
+static inline void rwlock_write_cleanup(rwlock_t** lock)
+{
+    rwlock_write_release(*lock);
+}
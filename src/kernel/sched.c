@@ -2,6 +2,7 @@
 
 #include "_AUX/ERR.h"
 #include "apic.h"
+#include "cpuid.h"
 #include "gdt.h"
 #include "hpet.h"
 #include "loader.h"
@@ -10,6 +11,7 @@
 #include "queue.h"
 #include "regs.h"
 #include "smp.h"
+#include "sysfs.h"
 #include "thread.h"
 #include "time.h"
 #include "trap.h"
@@ -22,50 +24,75 @@
 #include <sys/math.h>
 #include <sys/proc.h>
 
-static list_t blockers;
-static lock_t blockersLock;
-
 static blocker_t sleepBlocker;
 
+static bool monitorEnabled = false;
+
+// Bit n is set while cpu n is idle, lets placement and wakeups find an idle cpu without looking at every cpu.
+static atomic_uint64_t idleMask[SMP_MASK_WORDS];
+
 void blocker_init(blocker_t* blocker)
 {
-    list_entry_init(&blocker->entry);
     list_init(&blocker->threads);
+    atomic_init(&blocker->generation, 0);
     lock_init(&blocker->lock);
-
-    LOCK_GUARD(&blockersLock);
-    list_push(&blockers, blocker);
 }
 
 void blocker_cleanup(blocker_t* blocker)
 {
-    lock_acquire(&blocker->lock);
+    LOCK_GUARD(&blocker->lock);
 
     if (!list_empty(&blocker->threads))
     {
         log_panic(NULL, "Blocker with pending threads freed");
     }
-    lock_release(&blocker->lock);
+}
 
-    LOCK_GUARD(&blockersLock);
-    list_remove(blocker);
+uint64_t blocker_generation(blocker_t* blocker)
+{
+    return atomic_load(&blocker->generation);
 }
 
-static void blocker_push(blocker_t* blocker, thread_t* thread)
+// Lock order is always the blocker followed by the wheel holding the threads timer.
+static bool blocker_push(blocker_t* blocker, thread_t* thread, wheel_t* wheel)
 {
     LOCK_GUARD(&blocker->lock);
 
-    thread_t* other;
-    LIST_FOR_EACH(other, &blocker->threads)
+    if (atomic_load(&blocker->generation) != thread->block.generation)
     {
-        if (other->block.deadline > thread->block.deadline)
-        {
-            list_prepend(&other->entry, thread);
-            return;
-        }
+        thread->block.result = BLOCK_NORM;
+        thread->block.blocker = NULL;
+        return false;
+    }
+
+    // Exclusive waiters are kept behind all other waiters so that an unblock can stop at the first exclusive waiter past
+    // its amount.
+    if (thread->block.exclusive)
+    {
+        list_push(&blocker->threads, thread);
+    }
+    else
+    {
+        list_append(&blocker->threads.head, thread);
+    }
+
+    if (thread->block.deadline != NEVER)
+    {
+        LOCK_GUARD(&wheel->lock);
+        wheel_add(wheel, &thread->block.timer, thread->block.deadline);
     }
 
-    list_push(&blocker->threads, thread);
+    return true;
+}
+
+static void blocker_disarm(thread_t* thread)
+{
+    wheel_t* wheel = thread->block.timer.wheel;
+    if (wheel != NULL)
+    {
+        LOCK_GUARD(&wheel->lock);
+        wheel_remove(wheel, &thread->block.timer);
+    }
 }
 
 void sched_context_init(sched_context_t* context)
@@ -74,36 +101,252 @@ void sched_context_init(sched_context_t* context)
     {
         queue_init(&context->queues[i]);
     }
+    list_init(&context->deadlineQueue);
+    list_init(&context->throttled);
+    lock_init(&context->deadlineLock);
+    atomic_init(&context->deadlineUtil, 0);
+    context->deadlineThrottles = 0;
+    context->deadlineMisses = 0;
+    atomic_init(&context->readyAmount, 0);
+    context->probe = 0;
+    wheel_init(&context->wheel);
+    context->timerFrequency = 0;
+    context->timerDeadline = NEVER;
+    context->timeoutAmount = 0;
+    context->timeoutLatencyTotal = 0;
+    context->timeoutLatencyMax = 0;
+    context->boostDeadline = 0;
+    atomic_init(&context->boostEpoch, 0);
+    context->balanceDeadline = 0;
+    context->loadAvg = 0;
+    context->balanceRuns = 0;
+    context->balanceMovesOut = 0;
+    context->balanceMovesIn = 0;
+    context->steals = 0;
     list_init(&context->graveyard);
+    list_init(&context->reapable);
+    lock_init(&context->reapLock);
+    blocker_init(&context->reaperBlocker);
+    context->reaped = 0;
+    context->scheduleMax = 0;
     context->runThread = NULL;
+    context->needResched = false;
+    context->idle = false;
+    atomic_init(&context->wake, 0);
+    context->idleEntries = 0;
+    context->wakeStores = 0;
+    context->wakeIpis = 0;
+    context->idleStart = 0;
+    context->idleTime = 0;
+    context->contextSwitches = 0;
+    context->runqueueSamples = 0;
+    context->runqueueTotal = 0;
+    context->runqueueMax = 0;
+}
+
+static nsec_t sched_deadline_key(const thread_t* thread, bool throttled)
+{
+    return throttled ? thread->deadline.periodStart : thread->deadline.absDeadline;
+}
+
+// Keeps list ordered by key, threads with equal keys stay in the order they were inserted.
+static void sched_deadline_insert(list_t* list, thread_t* thread, bool throttled)
+{
+    nsec_t key = sched_deadline_key(thread, throttled);
+
+    thread_t* other;
+    LIST_FOR_EACH_REVERSE(other, list)
+    {
+        if (sched_deadline_key(other, throttled) <= key)
+        {
+            list_append(&other->entry, thread);
+            return;
+        }
+    }
+
+    list_append(&list->head, thread);
 }
 
 static void sched_context_push(sched_context_t* context, thread_t* thread)
 {
+    atomic_fetch_add(&context->readyAmount, 1);
+    if (thread_is_deadline(thread))
+    {
+        LOCK_GUARD(&context->deadlineLock);
+        sched_deadline_insert(&context->deadlineQueue, thread, false);
+        return;
+    }
+
+    thread->boostEpoch = atomic_load(&context->boostEpoch);
+    queue_push(&context->queues[thread->priority], thread);
+}
+
+// A thread queued before the last boost of the cpu it was taken from was spliced into the top level, its priority is
+// only moved back to its base once it is dequeued. Returns true if that put it below level, it is then queued on its
+// own level instead and must not be taken, each thread is moved at most once per boost.
+static bool sched_context_settle(sched_context_t* context, thread_t* thread, priority_t level)
+{
+    uint64_t epoch = atomic_load(&context->boostEpoch);
+    if (thread->boostEpoch == epoch)
+    {
+        return false;
+    }
+
+    if (thread->priority != thread->basePriority)
+    {
+        thread_set_priority(thread, thread->basePriority);
+    }
+    thread->boostEpoch = epoch;
+
+    if (thread->priority >= level)
+    {
+        return false;
+    }
+
     queue_push(&context->queues[thread->priority], thread);
+    return true;
 }
 
-static uint64_t sched_context_thread_amount(const sched_context_t* context)
+static thread_t* sched_context_pop(sched_context_t* context, priority_t priority)
 {
-    uint64_t length = (context->runThread != NULL);
-    for (int64_t i = PRIORITY_MAX; i >= PRIORITY_MIN; i--)
+    while (1)
+    {
+        thread_t* thread = queue_pop(&context->queues[priority]);
+        if (thread == NULL)
+        {
+            return NULL;
+        }
+
+        if (!sched_context_settle(context, thread, priority))
+        {
+            atomic_fetch_sub(&context->readyAmount, 1);
+            return thread;
+        }
+    }
+}
+
+static uint64_t sched_context_load(const sched_context_t* context)
+{
+    return atomic_load(&context->readyAmount) + (context->runThread != NULL);
+}
+
+// Hands a dead thread that is not running to the reaper of this cpu, freeing it can take long and is never done by the
+// scheduler itself.
+static void sched_bury(sched_context_t* context, thread_t* thread)
+{
+    lock_acquire(&context->reapLock);
+    list_push(&context->reapable, thread);
+    lock_release(&context->reapLock);
+
+    sched_unblock(&context->reaperBlocker);
+}
+
+// Runtime a deadline thread is given when its slice is renewed. A thread that used up its budget while holding a mutex
+// overruns it in short slices instead of being throttled, as everyone waiting on the mutex would stall until its next
+// period.
+static nsec_t sched_deadline_slice(const thread_t* thread)
+{
+    if (thread->deadline.budget == 0 && thread->mutexDepth != 0)
+    {
+        return CONFIG_TIME_SLICE_MIN;
+    }
+
+    return thread->deadline.budget;
+}
+
+// Whether thread should take the cpu from running, deadline threads run ahead of every normal thread.
+static bool sched_preempts(const thread_t* thread, const thread_t* running)
+{
+    if (thread_is_deadline(thread))
+    {
+        return !thread_is_deadline(running) || thread->deadline.absDeadline < running->deadline.absDeadline;
+    }
+
+    return !thread_is_deadline(running) && thread->priority > running->priority;
+}
+
+// Returns the deadline thread with the earliest deadline if it should preempt running, running can be NULL.
+static thread_t* sched_context_find_deadline(sched_context_t* context, const thread_t* running)
+{
+    lock_acquire(&context->deadlineLock);
+    thread_t* thread = list_first(&context->deadlineQueue);
+    if (thread == NULL || (running != NULL && !sched_preempts(thread, running)))
+    {
+        lock_release(&context->deadlineLock);
+        return NULL;
+    }
+    list_remove(thread);
+    lock_release(&context->deadlineLock);
+    atomic_fetch_sub(&context->readyAmount, 1);
+
+    if (thread->process->killed && thread->trapFrame.cs != GDT_KERNEL_CODE)
+    {
+        sched_bury(context, thread);
+        return sched_context_find_deadline(context, running);
+    }
+
+    return thread;
+}
+
+// Parks a deadline thread that used up its budget or yielded until its next period starts.
+static void sched_deadline_throttle(sched_context_t* context, thread_t* thread, nsec_t uptime)
+{
+    thread_deadline_t* deadline = &thread->deadline;
+    if (uptime > deadline->absDeadline)
+    {
+        context->deadlineMisses++;
+    }
+    if (thread->timeEnd != 0)
+    {
+        context->deadlineThrottles++;
+    }
+
+    // A thread that fell more than a period behind starts over instead of being handed every period it missed.
+    deadline->periodStart += deadline->period;
+    if (deadline->periodStart + deadline->period <= uptime)
     {
-        length += queue_length(&context->queues[i]);
+        deadline->periodStart = uptime;
     }
+    deadline->budget = 0;
 
-    return length;
+    LOCK_GUARD(&context->deadlineLock);
+    sched_deadline_insert(&context->throttled, thread, true);
+}
+
+// Moves the throttled threads whose next period has started back to the deadline queue with a full budget.
+static void sched_deadline_replenish(sched_context_t* context, nsec_t uptime)
+{
+    LOCK_GUARD(&context->deadlineLock);
+
+    while (1)
+    {
+        thread_t* thread = list_first(&context->throttled);
+        if (thread == NULL || thread->deadline.periodStart > uptime)
+        {
+            break;
+        }
+        list_remove(thread);
+
+        thread_deadline_t* deadline = &thread->deadline;
+        deadline->absDeadline = deadline->periodStart + deadline->deadline;
+        deadline->budget = deadline->runtime;
+        thread->stats.readyTime = uptime;
+
+        sched_deadline_insert(&context->deadlineQueue, thread, false);
+        atomic_fetch_add(&context->readyAmount, 1);
+    }
 }
 
 static thread_t* sched_context_find_higher(sched_context_t* context, priority_t priority)
 {
     for (int64_t i = PRIORITY_MAX; i > priority; i--)
     {
-        thread_t* thread = queue_pop(&context->queues[i]);
+        thread_t* thread = sched_context_pop(context, i);
         if (thread != NULL)
         {
             if (thread->process->killed && thread->trapFrame.cs != GDT_KERNEL_CODE)
             {
-                thread_free(thread);
+                sched_bury(context, thread);
                 return sched_context_find_higher(context, priority);
             }
             return thread;
@@ -115,14 +358,20 @@ static thread_t* sched_context_find_higher(sched_context_t* context, priority_t
 
 static thread_t* sched_context_find_any(sched_context_t* context)
 {
+    thread_t* deadline = sched_context_find_deadline(context, NULL);
+    if (deadline != NULL)
+    {
+        return deadline;
+    }
+
     for (int64_t i = PRIORITY_MAX; i >= PRIORITY_MIN; i--)
     {
-        thread_t* thread = queue_pop(&context->queues[i]);
+        thread_t* thread = sched_context_pop(context, i);
         if (thread != NULL)
         {
             if (thread->process->killed && thread->trapFrame.cs != GDT_KERNEL_CODE)
             {
-                thread_free(thread);
+                sched_bury(context, thread);
                 return sched_context_find_any(context);
             }
 
@@ -133,6 +382,75 @@ static thread_t* sched_context_find_any(sched_context_t* context)
     return NULL;
 }
 
+static bool sched_steal_allowed(void* element, void* private)
+{
+    const thread_t* thread = element;
+    const cpu_t* self = private;
+    return thread_cpu_allowed(thread, self->id);
+}
+
+// Called by an idle cpu, takes the highest priority thread allowed to run on it from the cpu with the most threads
+// waiting to run.
+static thread_t* sched_context_steal(cpu_t* self)
+{
+    cpu_t* victim = NULL;
+    uint64_t victimAmount = 0;
+    uint8_t cpuAmount = smp_cpu_amount();
+    for (uint8_t id = 0; id < cpuAmount; id++)
+    {
+        cpu_t* cpu = smp_cpu(id);
+        uint64_t amount = atomic_load(&cpu->sched.readyAmount);
+        if (cpu != self && amount > victimAmount)
+        {
+            victimAmount = amount;
+            victim = cpu;
+        }
+    }
+
+    if (victim == NULL)
+    {
+        return NULL;
+    }
+
+    for (int64_t i = PRIORITY_MAX; i >= PRIORITY_MIN; i--)
+    {
+        thread_t* thread = queue_pop_if(&victim->sched.queues[i], sched_steal_allowed, self);
+        if (thread == NULL)
+        {
+            continue;
+        }
+        if (sched_context_settle(&victim->sched, thread, i))
+        {
+            i++;
+            continue;
+        }
+        atomic_fetch_sub(&victim->sched.readyAmount, 1);
+
+        if (thread->process->killed && thread->trapFrame.cs != GDT_KERNEL_CODE)
+        {
+            sched_bury(&self->sched, thread);
+            i++;
+            continue;
+        }
+
+        self->sched.steals++;
+        return thread;
+    }
+
+    return NULL;
+}
+
+static thread_t* sched_context_find_next(cpu_t* self)
+{
+    thread_t* next = sched_context_find_any(&self->sched);
+    if (next == NULL)
+    {
+        next = sched_context_steal(self);
+    }
+
+    return next;
+}
+
 static void sched_spawn_init_thread(void)
 {
     thread_t* thread = thread_new(NULL, NULL, PRIORITY_MAX);
@@ -143,30 +461,422 @@ static void sched_spawn_init_thread(void)
 
 void sched_init(void)
 {
-    list_init(&blockers);
-    lock_init(&blockersLock);
-
     blocker_init(&sleepBlocker);
 
+    monitorEnabled = cpuid_monitor_avail();
+    for (uint64_t i = 0; i < SMP_MASK_WORDS; i++)
+    {
+        atomic_init(&idleMask[i], 0);
+    }
+
     sched_spawn_init_thread();
 
     log_print("sched: init");
 }
 
-static void sched_start_ipi(trap_frame_t* trapFrame)
+#if CONFIG_SCHED_TICKLESS
+// Programs the one shot timer for the earliest of the next timer wheel deadline and the end of the current slice, an
+// idle cpu with no pending timers stops its timer entirely and is only woken by VECTOR_SCHED_WAKE.
+static void sched_timer_arm(sched_context_t* context)
+{
+    nsec_t uptime = time_uptime();
+
+    lock_acquire(&context->wheel.lock);
+    nsec_t deadline = wheel_next_deadline(&context->wheel);
+    lock_release(&context->wheel.lock);
+
+    lock_acquire(&context->deadlineLock);
+    thread_t* throttled = list_first(&context->throttled);
+    if (throttled != NULL)
+    {
+        deadline = MIN(deadline, throttled->deadline.periodStart);
+    }
+    lock_release(&context->deadlineLock);
+
+    thread_t* thread = context->runThread;
+    if (thread != NULL)
+    {
+        // A thread that outlived its slice with nothing else to run is given a new one.
+        if (thread->timeEnd < uptime)
+        {
+            thread->timeEnd = uptime + (thread_is_deadline(thread) ? sched_deadline_slice(thread)
+                                                                   : priority_time_slice(thread->priority) - thread->sliceUsed);
+        }
+        deadline = MIN(deadline, thread->timeEnd);
+    }
+    else
+    {
+        // Pairs with the push in sched_push, either the pusher sees this cpu as idle or the pushed thread is seen here.
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load(&context->readyAmount) != 0)
+        {
+            deadline = uptime;
+        }
+    }
+
+    if (deadline != NEVER)
+    {
+        deadline = MIN(deadline, uptime + SEC);
+    }
+
+    if (deadline == context->timerDeadline && deadline > uptime && lapic_read(LAPIC_REG_TIMER_CURRENT_COUNT) != 0)
+    {
+        return;
+    }
+    context->timerDeadline = deadline;
+
+    if (deadline == NEVER)
+    {
+        apic_timer_stop();
+        return;
+    }
+
+    nsec_t delta = deadline > uptime ? deadline - uptime : 0;
+    apic_timer_one_shot(VECTOR_SCHED_TIMER, CLAMP(delta * context->timerFrequency / SEC, 1, UINT32_MAX));
+}
+#endif
+
+static bool sched_cpu_idle(uint8_t id)
+{
+    return (atomic_load(&idleMask[id / 64]) & (1ULL << (id % 64))) != 0;
+}
+
+// Returns an idle cpu that thread is allowed to run on, any idle cpu if thread is NULL.
+static cpu_t* sched_idle_find(const thread_t* thread)
+{
+    uint8_t cpuAmount = smp_cpu_amount();
+    for (uint64_t i = 0; i < SMP_MASK_WORDS; i++)
+    {
+        uint64_t bits = atomic_load(&idleMask[i]);
+        while (bits != 0)
+        {
+            uint8_t id = i * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            if (id < cpuAmount && (thread == NULL || thread_cpu_allowed(thread, id)))
+            {
+                return smp_cpu(id);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+// Publishes whether the cpu is idle, called once the next thread has been chosen.
+static void sched_idle_update(cpu_t* self, nsec_t uptime)
+{
+    sched_context_t* context = &self->sched;
+    bool idle = context->runThread == NULL;
+    if (idle == context->idle)
+    {
+        return;
+    }
+    context->idle = idle;
+
+    uint64_t bit = 1ULL << (self->id % 64);
+    if (idle)
+    {
+        context->idleEntries++;
+        context->idleStart = uptime;
+        // Pairs with the push in sched_push, either the pusher sees this cpu as idle or the idle loop sees the thread.
+        atomic_fetch_or(&idleMask[self->id / 64], bit);
+    }
+    else
+    {
+        context->idleTime += uptime - context->idleStart;
+        atomic_fetch_and(&idleMask[self->id / 64], ~bit);
+    }
+}
+
+// Makes cpu schedule soon. An idle cpu waiting in mwait only needs a store to the word it monitors, anything else is
+// interrupted.
+static void sched_kick(cpu_t* self, cpu_t* cpu)
+{
+    if (monitorEnabled && sched_cpu_idle(cpu->id))
+    {
+        atomic_store(&cpu->sched.wake, 1);
+        self->sched.wakeStores++;
+    }
+    else
+    {
+        lapic_send_ipi(cpu->lapicId, VECTOR_SCHED_WAKE);
+        self->sched.wakeIpis++;
+    }
+}
+
+// Idle cpus might not have a timer running, so they must be woken to notice new threads. If the thread was pushed to a
+// busy cpu an idle cpu is woken instead so that it can steal it.
+static void sched_wake(cpu_t* self, cpu_t* target)
+{
+    if (sched_cpu_idle(target->id))
+    {
+        sched_kick(self, target);
+        return;
+    }
+
+    cpu_t* idle = sched_idle_find(NULL);
+    if (idle != NULL)
+    {
+        sched_kick(self, idle);
+    }
+}
+
+static inline void sched_monitor(const void* address)
+{
+    asm volatile("monitor" : : "a"(address), "c"(0), "d"(0));
+}
+
+NORETURN void sched_idle_loop(void)
+{
+    // The idle loop never leaves its cpu, so the context only has to be found once.
+    sched_context_t* context = &smp_self_unsafe()->sched;
+    while (1)
+    {
+        // Interrupts are disabled between checking for work and waiting, sti delays them until after the next
+        // instruction so that one arriving in between still ends the wait.
+        asm volatile("cli");
+        bool kicked = atomic_exchange(&context->wake, 0) != 0;
+        if (monitorEnabled)
+        {
+            sched_monitor(&context->wake);
+        }
+
+        if (kicked || atomic_load(&context->wake) != 0 || atomic_load(&context->readyAmount) != 0)
+        {
+            asm volatile("sti");
+            sched_invoke();
+            continue;
+        }
+
+        if (monitorEnabled)
+        {
+            asm volatile("sti; mwait" : : "a"(0), "c"(0) : "memory");
+        }
+        else
+        {
+            asm volatile("sti; hlt" : : : "memory");
+        }
+    }
+}
+
+static void sched_timer_print(sysfs_text_t* text, void* private)
+{
+    sysfs_text_print(text, "mode %s\n", CONFIG_SCHED_TICKLESS ? "tickless" : "periodic");
+    sysfs_text_print(text, "cpu interrupts timeouts latency_avg latency_max irq_off_max(cycles)\n");
+
+    uint8_t cpuAmount = smp_cpu_amount();
+    for (uint8_t id = 0; id < cpuAmount; id++)
+    {
+        cpu_t* cpu = smp_cpu(id);
+        uint64_t timeoutAmount = cpu->sched.timeoutAmount;
+        sysfs_text_print(text, "%d %d %d %d %d %d\n", (uint64_t)id, cpu->timerInterrupts, timeoutAmount,
+            timeoutAmount != 0 ? cpu->sched.timeoutLatencyTotal / timeoutAmount : 0, cpu->sched.timeoutLatencyMax,
+            cpu->cliMax);
+    }
+}
+
+static void sched_priority_print_thread(sysfs_text_t* text, const thread_snapshot_t* thread)
+{
+    sysfs_text_print(text, "%d %d %d %d", thread->pid, thread->id, (uint64_t)thread->basePriority,
+        (uint64_t)thread->priority);
+
+    const priority_history_t* history = &thread->history;
+    uint64_t first = history->count > CONFIG_PRIORITY_HISTORY ? history->count - CONFIG_PRIORITY_HISTORY : 0;
+    for (uint64_t i = first; i < history->count; i++)
+    {
+        const priority_change_t* change = &history->changes[i % CONFIG_PRIORITY_HISTORY];
+        sysfs_text_print(text, " %d:%d", change->time / (SEC / 1000), (uint64_t)change->priority);
+    }
+    sysfs_text_print(text, "\n");
+}
+
+static void sched_priority_print(sysfs_text_t* text, void* private)
+{
+    sysfs_text_print(text, "pid tid base priority history(ms:priority)\n");
+
+    uint64_t amount;
+    thread_snapshot_t* threads = thread_snapshot(&amount);
+    for (uint64_t i = 0; i < amount; i++)
+    {
+        sched_priority_print_thread(text, &threads[i]);
+    }
+    free(threads);
+}
+
+static void sched_migration_print(sysfs_text_t* text, void* private)
+{
+    sysfs_text_print(text, "pid tid cpu affinity migrations\n");
+
+    uint64_t amount;
+    thread_snapshot_t* threads = thread_snapshot(&amount);
+    for (uint64_t i = 0; i < amount; i++)
+    {
+        const thread_snapshot_t* thread = &threads[i];
+        uint64_t lastCpu = thread->lastCpu != THREAD_CPU_NONE ? thread->lastCpu : 0;
+        sysfs_text_print(text, "%d %d %d %x %d\n", thread->pid, thread->id, lastCpu, thread->affinity,
+            thread->migrations);
+    }
+    free(threads);
+}
+
+static void sched_idle_print(sysfs_text_t* text, void* private)
+{
+    sysfs_text_print(text, "mode %s\n", monitorEnabled ? "mwait" : "hlt");
+    sysfs_text_print(text, "cpu idle entries wake_stores wake_ipis\n");
+
+    uint8_t cpuAmount = smp_cpu_amount();
+    for (uint8_t id = 0; id < cpuAmount; id++)
+    {
+        sched_context_t* context = &smp_cpu(id)->sched;
+        sysfs_text_print(text, "%d %d %d %d %d\n", (uint64_t)id, (uint64_t)sched_cpu_idle(id), context->idleEntries,
+            context->wakeStores, context->wakeIpis);
+    }
+}
+
+static void sched_cpu_print(sysfs_text_t* text, void* private)
+{
+    sysfs_text_print(text, "cpu switches idle_us runqueue_avg(x100) runqueue_max reaped schedule_max(cycles)\n");
+
+    nsec_t uptime = time_uptime();
+    uint8_t cpuAmount = smp_cpu_amount();
+    for (uint8_t id = 0; id < cpuAmount; id++)
+    {
+        sched_context_t* context = &smp_cpu(id)->sched;
+        nsec_t idleTime = context->idleTime + (context->idle ? uptime - context->idleStart : 0);
+        uint64_t samples = context->runqueueSamples;
+        sysfs_text_print(text, "%d %d %d %d %d %d %d\n", (uint64_t)id, context->contextSwitches,
+            idleTime / (SEC / 1000000), samples != 0 ? context->runqueueTotal * 100 / samples : 0, context->runqueueMax,
+            context->reaped, context->scheduleMax);
+    }
+}
+
+static void sched_thread_print_thread(sysfs_text_t* text, const thread_snapshot_t* thread)
+{
+    const thread_stats_t* stats = &thread->stats;
+    sysfs_text_print(text, "%d %d %d %d %d %d", thread->pid, thread->id, (uint64_t)thread->priority,
+        stats->cpuTime / (SEC / 1000000), stats->voluntarySwitches, stats->preemptions);
+    for (uint64_t i = 0; i < THREAD_WAIT_BUCKETS; i++)
+    {
+        sysfs_text_print(text, " %d", stats->waitHistogram[i]);
+    }
+    sysfs_text_print(text, "\n");
+}
+
+static void sched_thread_print(sysfs_text_t* text, void* private)
+{
+    sysfs_text_print(text,
+        "pid tid priority cpu_us voluntary preempted wait<10us wait<100us wait<1ms wait<10ms wait<100ms wait>=100ms\n");
+
+    uint64_t amount;
+    thread_snapshot_t* threads = thread_snapshot(&amount);
+    for (uint64_t i = 0; i < amount; i++)
+    {
+        sched_thread_print_thread(text, &threads[i]);
+    }
+    free(threads);
+}
+
+static void sched_deadline_print(sysfs_text_t* text, void* private)
+{
+    sysfs_text_print(text, "cpu util_percent throttles misses\n");
+
+    uint8_t cpuAmount = smp_cpu_amount();
+    for (uint8_t id = 0; id < cpuAmount; id++)
+    {
+        sched_context_t* context = &smp_cpu(id)->sched;
+        sysfs_text_print(text, "%d %d %d %d\n", (uint64_t)id,
+            atomic_load(&context->deadlineUtil) * 100 / THREAD_DEADLINE_SCALE, context->deadlineThrottles,
+            context->deadlineMisses);
+    }
+}
+
+static void sched_balance_print(sysfs_text_t* text, void* private)
+{
+    sysfs_text_print(text, "cpu load_avg(x100) balances moved_out moved_in steals\n");
+
+    uint8_t cpuAmount = smp_cpu_amount();
+    for (uint8_t id = 0; id < cpuAmount; id++)
+    {
+        sched_context_t* context = &smp_cpu(id)->sched;
+        sysfs_text_print(text, "%d %d %d %d %d %d\n", (uint64_t)id, context->loadAvg * 100 / SCHED_LOAD_SCALE,
+            context->balanceRuns, context->balanceMovesOut, context->balanceMovesIn, context->steals);
+    }
+}
+
+// Frees the dead threads of one cpu, tearing down the last thread of a process frees its whole address space.
+static void sched_reaper_loop(sched_context_t* context)
+{
+    while (1)
+    {
+        list_t dead;
+        list_init(&dead);
+
+        SCHED_BLOCK_LOCK(&context->reaperBlocker, &context->reapLock, !list_empty(&context->reapable));
+        list_splice(&dead, &context->reapable);
+        lock_release(&context->reapLock);
+
+        while (1)
+        {
+            thread_t* thread = list_pop(&dead);
+            if (thread == NULL)
+            {
+                break;
+            }
+
+            thread_free(thread);
+            context->reaped++;
+        }
+    }
+}
+
+static void sched_reaper_spawn(uint8_t id)
 {
+    thread_t* reaper = thread_split(sched_thread(), sched_reaper_loop, PRIORITY_USER);
+    reaper->trapFrame.rdi = (uint64_t)&smp_cpu(id)->sched;
+    // Kept on its own cpu where possible so that the threads it frees are still in its cache.
+    if (id < 64)
+    {
+        reaper->affinity = 1ULL << id;
+    }
+    sched_push(reaper);
+}
+
+static void sched_start_call(void* private)
+{
+#if CONFIG_SCHED_TICKLESS
+    sched_context_t* context = &smp_self_unsafe()->sched;
+    context->timerFrequency = apic_timer_calibrate();
+    sched_timer_arm(context);
+#else
     nsec_t uptime = time_uptime();
     nsec_t interval = (SEC / CONFIG_SCHED_HZ) / smp_cpu_amount();
     nsec_t offset = ROUND_UP(uptime, interval) - uptime;
     hpet_sleep(offset + interval * smp_self_unsafe()->id);
 
     apic_timer_init(VECTOR_SCHED_TIMER, CONFIG_SCHED_HZ);
+#endif
 }
 
-void sched_start(void)
-{
-    smp_send_others(sched_start_ipi);
-    smp_send_self(sched_start_ipi);
+void sched_start(void)
+{
+    uint8_t cpuAmount = smp_cpu_amount();
+    for (uint8_t id = 0; id < cpuAmount; id++)
+    {
+        sched_reaper_spawn(id);
+    }
+
+    smp_mask_t mask;
+    smp_mask_all(&mask);
+    smp_call_mask(&mask, sched_start_call, NULL);
+
+    sysfs_expose_text("/stats", "timer", sched_timer_print, NULL);
+    sysfs_expose_text("/stats", "priority", sched_priority_print, NULL);
+    sysfs_expose_text("/stats", "migration", sched_migration_print, NULL);
+    sysfs_expose_text("/stats", "balance", sched_balance_print, NULL);
+    sysfs_expose_text("/stats", "idle", sched_idle_print, NULL);
+    sysfs_expose_text("/stats", "sched", sched_cpu_print, NULL);
+    sysfs_expose_text("/stats", "threads", sched_thread_print, NULL);
+    sysfs_expose_text("/stats", "deadline", sched_deadline_print, NULL);
 
     log_print("sched: start");
 }
@@ -177,43 +887,84 @@ block_result_t sched_sleep(nsec_t timeout)
 }
 
 block_result_t sched_block(blocker_t* blocker, nsec_t timeout)
+{
+    return sched_block_generation(blocker, blocker_generation(blocker), timeout);
+}
+
+static block_result_t sched_block_common(blocker_t* blocker, uint64_t generation, nsec_t timeout, bool exclusive)
 {
     LOG_ASSERT(rflags_read() & RFLAGS_INTERRUPT_ENABLE, "sched_block, interupts disabled");
 
-    thread_t* thread = smp_self()->sched.runThread;
+    cli_push();
+    thread_t* thread = SMP_SELF_READ(sched.runThread);
     thread->timeEnd = 0;
     thread->block.deadline = timeout == NEVER ? NEVER : timeout + time_uptime();
+    thread->block.generation = generation;
     thread->block.blocker = blocker;
-    smp_put();
+    thread->block.exclusive = exclusive;
+    cli_pop();
 
     sched_invoke();
     return thread->block.result;
 }
 
+block_result_t sched_block_generation(blocker_t* blocker, uint64_t generation, nsec_t timeout)
+{
+    return sched_block_common(blocker, generation, timeout, false);
+}
+
+block_result_t sched_block_exclusive(blocker_t* blocker, uint64_t generation, nsec_t timeout)
+{
+    return sched_block_common(blocker, generation, timeout, true);
+}
+
 void sched_unblock(blocker_t* blocker)
+{
+    sched_unblock_n(blocker, UINT64_MAX);
+}
+
+void sched_unblock_one(blocker_t* blocker)
+{
+    sched_unblock_n(blocker, 1);
+}
+
+uint64_t sched_unblock_n(blocker_t* blocker, uint64_t amount)
 {
     LOCK_GUARD(&blocker->lock);
 
-    while (1)
+    atomic_fetch_add(&blocker->generation, 1);
+
+    uint64_t unblocked = 0;
+    uint64_t exclusive = 0;
+    thread_t* thread;
+    thread_t* temp;
+    LIST_FOR_EACH_SAFE(thread, temp, &blocker->threads)
     {
-        thread_t* thread = list_pop(&blocker->threads);
-        if (thread == NULL)
+        if (thread->block.exclusive)
         {
-            break;
+            if (exclusive == amount)
+            {
+                break;
+            }
+            exclusive++;
         }
 
+        list_remove(thread);
+        blocker_disarm(thread);
         thread->block.deadline = 0;
         thread->block.result = BLOCK_NORM;
         thread->block.blocker = NULL;
         sched_push(thread);
+        unblocked++;
     }
+
+    return unblocked;
 }
 
+// The running thread is the same no matter which cpu it is read on, so a single load needs no protection from migration.
 thread_t* sched_thread(void)
 {
-    thread_t* thread = smp_self()->sched.runThread;
-    smp_put();
-    return thread;
+    return SMP_SELF_READ(sched.runThread);
 }
 
 process_t* sched_process(void)
@@ -232,24 +983,168 @@ void sched_invoke(void)
     asm volatile("int %0" ::"i"(VECTOR_SCHED_INVOKE));
 }
 
+void sched_invoke_if_needed(void)
+{
+    if (SMP_SELF_READ(sched.needResched))
+    {
+        sched_invoke();
+    }
+}
+
 void sched_yield(void)
 {
-    thread_t* thread = smp_self()->sched.runThread;
+    cli_push();
+    thread_t* thread = SMP_SELF_READ(sched.runThread);
     thread->timeEnd = 0;
-    smp_put();
+    thread->deadline.budget = 0;
+    cli_pop();
+
+    sched_invoke();
+}
+
+uint64_t sched_nice(int64_t nice)
+{
+    if (nice < NICE_MIN || nice > NICE_MAX)
+    {
+        return ERROR(EINVAL);
+    }
+
+    cli_push();
+    sched_context_t* context = &smp_self_unsafe()->sched;
+    thread_t* thread = context->runThread;
+    thread->basePriority = PRIORITY_USER - nice;
+    thread_set_priority(thread, thread->basePriority);
+    thread->timeStart = time_uptime();
+    thread->timeEnd = thread->timeStart + priority_time_slice(thread->priority);
+
+    // A thread that lowered its priority may no longer be the most important thread on this cpu.
+    context->needResched = true;
+    cli_pop();
+
+    return 0;
+}
+
+uint64_t sched_affinity(cpumask_t mask)
+{
+    if (!smp_mask_valid(mask))
+    {
+        return ERROR(EINVAL);
+    }
+
+    cli_push();
+    cpu_t* self = smp_self_unsafe();
+    thread_t* thread = self->sched.runThread;
+    if (thread_is_deadline(thread))
+    {
+        // The thread is pinned to the cpu that reserved its utilization.
+        cli_pop();
+        return ERROR(EBUSY);
+    }
+    thread->affinity = mask;
+    if (!thread_cpu_allowed(thread, self->id))
+    {
+        self->sched.needResched = true;
+    }
+    cli_pop();
+
+    return 0;
+}
+
+// Reserves util on the allowed cpu with the least reserved utilization that stays within CONFIG_SCHED_DEADLINE_UTIL,
+// deadline threads never migrate so each cpu only has to be schedulable on its own.
+static cpu_t* sched_deadline_admit(const thread_t* thread, uint64_t util)
+{
+    uint64_t limit = (uint64_t)THREAD_DEADLINE_SCALE * CONFIG_SCHED_DEADLINE_UTIL / 100;
+    uint8_t cpuAmount = MIN(smp_cpu_amount(), 64);
+    while (1)
+    {
+        cpu_t* best = NULL;
+        uint64_t bestUtil = UINT64_MAX;
+        for (uint8_t id = 0; id < cpuAmount; id++)
+        {
+            cpu_t* cpu = smp_cpu(id);
+            uint64_t reserved = atomic_load(&cpu->sched.deadlineUtil);
+            if (thread_cpu_allowed(thread, id) && reserved + util <= limit && reserved < bestUtil)
+            {
+                bestUtil = reserved;
+                best = cpu;
+            }
+        }
+
+        if (best == NULL)
+        {
+            return NULL;
+        }
+
+        if (atomic_compare_exchange_strong(&best->sched.deadlineUtil, &bestUtil, bestUtil + util))
+        {
+            return best;
+        }
+    }
+}
+
+uint64_t sched_deadline(nsec_t runtime, nsec_t period, nsec_t deadline)
+{
+    if (runtime != 0 && (runtime > deadline || deadline > period))
+    {
+        return ERROR(EINVAL);
+    }
+
+    cli_push();
+    thread_t* thread = SMP_SELF_READ(sched.runThread);
+    thread_deadline_t* params = &thread->deadline;
+    if (thread_is_deadline(thread))
+    {
+        atomic_fetch_sub(&smp_cpu(params->cpu)->sched.deadlineUtil, params->util);
+        thread->affinity = params->affinity;
+        *params = (thread_deadline_t){0};
+    }
 
+    if (runtime == 0)
+    {
+        cli_pop();
+        return 0;
+    }
+
+    uint64_t util = MAX(runtime * THREAD_DEADLINE_SCALE / period, 1);
+    cpu_t* cpu = sched_deadline_admit(thread, util);
+    if (cpu == NULL)
+    {
+        cli_pop();
+        return ERROR(EBUSY);
+    }
+
+    nsec_t uptime = time_uptime();
+    *params = (thread_deadline_t){
+        .runtime = runtime,
+        .period = period,
+        .deadline = deadline,
+        .periodStart = uptime,
+        .absDeadline = uptime + deadline,
+        .budget = runtime,
+        .util = util,
+        .cpu = cpu->id,
+        .affinity = thread->affinity,
+    };
+    thread->affinity = 1ULL << cpu->id;
+    thread->timeEnd = 0;
+    cli_pop();
+
+    // The scheduler moves the thread to its cpu or starts its first period where it is.
     sched_invoke();
+    return 0;
 }
 
 void sched_process_exit(uint64_t status)
 {
     // TODO: Add handling for status
 
-    sched_context_t* context = &smp_self()->sched;
-    context->runThread->killed = true;
-    context->runThread->process->killed = true;
-    log_print("sched: process exit (%d)", context->runThread->process->id);
-    smp_put();
+    cli_push();
+    thread_t* thread = SMP_SELF_READ(sched.runThread);
+    thread->killed = true;
+    thread->process->killed = true;
+    log_print("sched: process exit (%d)", thread->process->id);
+    cli_pop();
 
     sched_invoke();
     log_panic(NULL, "returned from process_exit");
@@ -257,74 +1152,180 @@ void sched_process_exit(uint64_t status)
 
 void sched_thread_exit(void)
 {
-    sched_context_t* context = &smp_self()->sched;
-    context->runThread->killed = true;
-    smp_put();
+    cli_push();
+    SMP_SELF_READ(sched.runThread)->killed = true;
+    cli_pop();
 
     sched_invoke();
     log_panic(NULL, "returned from thread_exit");
 }
 
-void sched_push(thread_t* thread)
+// Prefers the cpu the thread last ran on to keep its cache warm, then the waking cpu which holds whatever the waker just
+// produced, then any idle cpu, then a single probed cpu so that bursts of new threads spread out without having to scan
+// every cpu. Cpus outside the affinity of the thread are never chosen, idle cpus will steal any remaining imbalance.
+static cpu_t* sched_push_target(cpu_t* self, const thread_t* thread)
 {
-    int64_t bestLength = INT64_MAX;
     cpu_t* best = NULL;
-    uint64_t cpuAmount = smp_cpu_amount();
-    for (uint64_t i = 0; i < cpuAmount; i++)
+    uint64_t bestLoad = UINT64_MAX;
+
+    cpu_t* last = thread->lastCpu != THREAD_CPU_NONE ? smp_cpu(thread->lastCpu) : self;
+    if (thread_cpu_allowed(thread, last->id))
     {
-        cpu_t* cpu = smp_cpu(i);
-        const sched_context_t* context = &cpu->sched;
+        bestLoad = sched_context_load(&last->sched);
+        if (bestLoad == 0)
+        {
+            return last;
+        }
+        best = last;
+    }
 
-        int64_t length = sched_context_thread_amount(context);
+    if (thread_cpu_allowed(thread, self->id))
+    {
+        uint64_t selfLoad = sched_context_load(&self->sched);
+        if (selfLoad == 0)
+        {
+            return self;
+        }
 
-        if (length == 0)
+        if (selfLoad < bestLoad)
         {
-            sched_context_push(&cpu->sched, thread);
-            return;
+            bestLoad = selfLoad;
+            best = self;
         }
+    }
+
+    cpu_t* idle = sched_idle_find(thread);
+    if (idle != NULL)
+    {
+        return idle;
+    }
 
-        if (length < bestLength)
+    uint8_t cpuAmount = smp_cpu_amount();
+    cpu_t* probe = smp_cpu(self->sched.probe++ % cpuAmount);
+    if (thread_cpu_allowed(thread, probe->id) && sched_context_load(&probe->sched) < bestLoad)
+    {
+        return probe;
+    }
+
+    if (best != NULL)
+    {
+        return best;
+    }
+
+    // None of the candidates are allowed, fall back to the least loaded allowed cpu.
+    for (uint8_t id = 0; id < cpuAmount; id++)
+    {
+        cpu_t* cpu = smp_cpu(id);
+        uint64_t load = sched_context_load(&cpu->sched);
+        if (thread_cpu_allowed(thread, id) && load < bestLoad)
         {
-            bestLength = length;
+            bestLoad = load;
             best = cpu;
         }
     }
 
-    sched_context_push(&best->sched, thread);
+    return best != NULL ? best : self;
 }
 
-static void sched_update_blockers(void)
+void sched_push(thread_t* thread)
 {
-    LOCK_GUARD(&blockersLock);
+    cpu_t* self = smp_self();
+    cpu_t* target = sched_push_target(self, thread);
     nsec_t uptime = time_uptime();
+    thread->stats.readyTime = uptime;
 
-    blocker_t* blocker;
-    LIST_FOR_EACH(blocker, &blockers)
+    // A deadline thread that slept through its deadline starts a new period when it wakes.
+    thread_deadline_t* deadline = &thread->deadline;
+    if (thread_is_deadline(thread) && uptime >= deadline->absDeadline)
     {
-        LOCK_GUARD(&blocker->lock);
+        deadline->periodStart = uptime;
+        deadline->absDeadline = uptime + deadline->deadline;
+        deadline->budget = deadline->runtime;
+    }
 
-        thread_t* thread = list_first(&blocker->threads);
-        if (thread != NULL && thread->block.deadline < uptime)
-        {
-            thread->block.result = BLOCK_TIMEOUT;
-            thread->block.blocker = NULL;
-            list_remove(thread);
-            sched_push(thread);
-        }
+    sched_context_push(&target->sched, thread);
+    if (target == self && self->sched.runThread != NULL && sched_preempts(thread, self->sched.runThread))
+    {
+        self->sched.needResched = true;
+    }
+
+    // A deadline thread can not be stolen, so its own cpu is interrupted even if it is busy.
+    if (target != self && thread_is_deadline(thread))
+    {
+        sched_kick(self, target);
     }
+    else
+    {
+        sched_wake(self, target);
+    }
+    smp_put();
 }
 
-static void sched_update_graveyard(trap_frame_t* trapFrame, sched_context_t* context)
+static void sched_update_timers(sched_context_t* context)
 {
+    list_t timedOut;
+    list_init(&timedOut);
+
+    nsec_t uptime = time_uptime();
+
+    wheel_t* wheel = &context->wheel;
+    lock_acquire(&wheel->lock);
+
+    wheel_advance(wheel, uptime);
+
+    wheel_entry_t* entry;
+    wheel_entry_t* temp;
+    LIST_FOR_EACH_SAFE(entry, temp, &wheel->expired)
+    {
+        thread_t* thread = CONTAINER_OF(entry, thread_t, block.timer);
+        blocker_t* blocker = thread->block.blocker;
+
+        // The wheel lock is already held so waiting for the blocker would invert the lock order, a busy blocker is
+        // instead retried on the next update.
+        if (!lock_try_acquire(&blocker->lock))
+        {
+            continue;
+        }
+
+        wheel_remove(wheel, entry);
+        list_remove(thread);
+        thread->block.result = BLOCK_TIMEOUT;
+        thread->block.blocker = NULL;
+        lock_release(&blocker->lock);
+
+        nsec_t latency = uptime - entry->deadline;
+        context->timeoutAmount++;
+        context->timeoutLatencyTotal += latency;
+        context->timeoutLatencyMax = MAX(context->timeoutLatencyMax, latency);
+
+        list_push(&timedOut, thread);
+    }
+
+    lock_release(&wheel->lock);
+
     while (1)
     {
-        thread_t* thread = list_pop(&context->graveyard);
+        thread_t* thread = list_pop(&timedOut);
         if (thread == NULL)
         {
             break;
         }
 
-        thread_free(thread);
+        sched_push(thread);
+    }
+}
+
+// Threads left in the graveyard by the previous schedule are no longer running, they are passed to the reaper in one
+// step no matter how many there are.
+static void sched_update_graveyard(trap_frame_t* trapFrame, sched_context_t* context)
+{
+    if (!list_empty(&context->graveyard))
+    {
+        lock_acquire(&context->reapLock);
+        list_splice(&context->reapable, &context->graveyard);
+        lock_release(&context->reapLock);
+
+        sched_unblock(&context->reaperBlocker);
     }
 
     if (context->runThread != NULL &&
@@ -335,6 +1336,141 @@ static void sched_update_graveyard(trap_frame_t* trapFrame, sched_context_t* con
     }
 }
 
+// Charges the time the thread ran since it was last accounted to its level. A thread that used up the slice of its level,
+// over any amount of runs, is demoted one level so that blocking just before the slice ends does not keep it high.
+static void sched_account(thread_t* thread, nsec_t uptime)
+{
+    nsec_t delta = uptime - thread->timeStart;
+    thread->stats.cpuTime += delta;
+    thread->timeStart = uptime;
+
+    // Deadline threads are charged to their budget instead.
+    if (thread_is_deadline(thread))
+    {
+        thread->deadline.budget = delta < thread->deadline.budget ? thread->deadline.budget - delta : 0;
+        return;
+    }
+
+    thread->sliceUsed += delta;
+
+    if (thread->sliceUsed < priority_time_slice(thread->priority))
+    {
+        return;
+    }
+
+    if (thread->priority > priority_floor(thread->basePriority))
+    {
+        thread_set_priority(thread, thread->priority - 1);
+    }
+    else
+    {
+        thread->sliceUsed = 0;
+    }
+}
+
+// Moves every thread of the cpu back to its base priority, threads starved on low levels get to run again and threads
+// that turned interactive after a cpu bound phase recover. Runs from the timer interrupt, so whole levels are spliced
+// into the top level in level order and each thread is moved to its base level when it is next dequeued, see
+// sched_context_settle(), so a boosted thread never preempts one with a higher base priority.
+static void sched_context_boost(sched_context_t* context)
+{
+    atomic_fetch_add(&context->boostEpoch, 1);
+
+    for (int64_t i = PRIORITY_MAX - 1; i >= PRIORITY_MIN; i--)
+    {
+        queue_splice(&context->queues[PRIORITY_MAX], &context->queues[i]);
+    }
+
+    thread_t* runThread = context->runThread;
+    if (runThread != NULL && runThread->priority != runThread->basePriority)
+    {
+        thread_set_priority(runThread, runThread->basePriority);
+    }
+}
+
+// A cpu that just became busy has a low average and a cpu that just went idle has a high one, using the smaller of the
+// average and the current load makes the balancer only act on imbalance that lasted and is still there.
+static uint64_t sched_context_balance_load(const sched_context_t* context)
+{
+    return MIN(context->loadAvg, sched_context_load(context) * SCHED_LOAD_SCALE);
+}
+
+typedef struct
+{
+    uint8_t target;
+    nsec_t uptime;
+} sched_balance_filter_t;
+
+static bool sched_balance_allowed(void* element, void* private)
+{
+    const thread_t* thread = element;
+    const sched_balance_filter_t* filter = private;
+    return thread_cpu_allowed(thread, filter->target) && thread->balanceTime + CONFIG_SCHED_MIGRATE_COOLDOWN <= filter->uptime;
+}
+
+// Runs periodically on every busy cpu, hands one waiting thread to the least loaded cpu if this cpu has been carrying
+// at least two threads more than it. Idle cpus steal on their own so this mainly evens out cpus that are all busy, and
+// a thread that was moved is left alone for CONFIG_SCHED_MIGRATE_COOLDOWN so that threads do not bounce between cpus.
+static void sched_balance(cpu_t* self, nsec_t uptime)
+{
+    sched_context_t* context = &self->sched;
+
+    // Exponential moving average with a weight of 1/4 per period.
+    context->loadAvg = (context->loadAvg * 3 + sched_context_load(context) * SCHED_LOAD_SCALE) / 4;
+    context->balanceDeadline = uptime + CONFIG_SCHED_BALANCE;
+
+    if (atomic_load(&context->readyAmount) == 0)
+    {
+        return;
+    }
+    context->balanceRuns++;
+
+    cpu_t* target = NULL;
+    uint64_t targetLoad = UINT64_MAX;
+    uint8_t cpuAmount = smp_cpu_amount();
+    for (uint8_t id = 0; id < cpuAmount; id++)
+    {
+        cpu_t* cpu = smp_cpu(id);
+        uint64_t load = sched_context_balance_load(&cpu->sched);
+        if (cpu != self && load < targetLoad)
+        {
+            targetLoad = load;
+            target = cpu;
+        }
+    }
+
+    if (target == NULL || sched_context_balance_load(context) < targetLoad + 2 * SCHED_LOAD_SCALE)
+    {
+        return;
+    }
+
+    // Low priority threads are the cpu bound ones that pile up, and they lose the least by running on a cold cache.
+    sched_balance_filter_t filter = {.target = target->id, .uptime = uptime};
+    for (int64_t i = PRIORITY_MIN; i <= PRIORITY_MAX; i++)
+    {
+        thread_t* thread = queue_pop_if(&context->queues[i], sched_balance_allowed, &filter);
+        if (thread == NULL)
+        {
+            continue;
+        }
+        if (sched_context_settle(context, thread, i))
+        {
+            // Moved to a lower level that may already have been passed.
+            i = PRIORITY_MIN - 1;
+            continue;
+        }
+        atomic_fetch_sub(&context->readyAmount, 1);
+
+        thread->balanceTime = uptime;
+        sched_context_push(&target->sched, thread);
+        context->balanceMovesOut++;
+        target->sched.balanceMovesIn++;
+
+        sched_kick(self, target);
+        return;
+    }
+}
+
 void sched_schedule(trap_frame_t* trapFrame)
 {
     cpu_t* self = smp_self_unsafe();
@@ -345,16 +1481,42 @@ void sched_schedule(trap_frame_t* trapFrame)
         return;
     }
 
-    if (self->id == 0)
+    uint64_t start = tsc_read();
+
+    context->needResched = false;
+
+    thread_t* prev = context->runThread;
+    uint64_t readyAmount = atomic_load(&context->readyAmount);
+    context->runqueueSamples++;
+    context->runqueueTotal += readyAmount;
+    context->runqueueMax = MAX(context->runqueueMax, readyAmount);
+
+    sched_update_timers(context);
+
+    sched_update_graveyard(trapFrame, context);
+
+    nsec_t uptime = time_uptime();
+    if (context->runThread != NULL)
     {
-        sched_update_blockers();
+        sched_account(context->runThread, uptime);
     }
 
-    sched_update_graveyard(trapFrame, context);
+    sched_deadline_replenish(context, uptime);
+
+    if (uptime >= context->boostDeadline)
+    {
+        sched_context_boost(context);
+        context->boostDeadline = uptime + CONFIG_SCHED_BOOST;
+    }
+
+    if (uptime >= context->balanceDeadline)
+    {
+        sched_balance(self, uptime);
+    }
 
     if (context->runThread == NULL)
     {
-        thread_t* next = sched_context_find_any(context);
+        thread_t* next = sched_context_find_next(self);
         thread_load(next, trapFrame);
         context->runThread = next;
     }
@@ -363,26 +1525,100 @@ void sched_schedule(trap_frame_t* trapFrame)
         blocker_t* blocker = context->runThread->block.blocker;
         if (blocker != NULL)
         {
+            // The thread keeps running if it was unblocked before it could be added to the blocker.
             thread_save(context->runThread, trapFrame);
-            blocker_push(blocker, context->runThread);
+            if (blocker_push(blocker, context->runThread, &context->wheel))
+            {
+                context->runThread->stats.voluntarySwitches++;
+
+                thread_t* next = sched_context_find_next(self);
+                thread_load(next, trapFrame);
+                context->runThread = next;
+            }
+        }
+        else if (!thread_cpu_allowed(context->runThread, self->id))
+        {
+            // The affinity of the thread changed while it was running, hand it to a cpu it is allowed on.
+            thread_t* thread = context->runThread;
+            thread_save(thread, trapFrame);
+            thread->stats.preemptions++;
+            context->runThread = NULL;
+            sched_push(thread);
+
+            thread_t* next = sched_context_find_next(self);
+            thread_load(next, trapFrame);
+            context->runThread = next;
+        }
+        else if (thread_is_deadline(context->runThread) && context->runThread->deadline.budget == 0 &&
+            context->runThread->mutexDepth == 0)
+        {
+            // The deadline thread used up its budget or yielded, it waits for its next period.
+            thread_t* thread = context->runThread;
+            thread_save(thread, trapFrame);
+            if (thread->timeEnd == 0)
+            {
+                thread->stats.voluntarySwitches++;
+            }
+            else
+            {
+                thread->stats.preemptions++;
+            }
+            sched_deadline_throttle(context, thread, uptime);
 
-            thread_t* next = sched_context_find_any(context);
+            thread_t* next = sched_context_find_next(self);
             thread_load(next, trapFrame);
             context->runThread = next;
         }
         else
         {
-            thread_t* next = context->runThread->timeEnd < time_uptime()
-                ? sched_context_find_any(context)
-                : sched_context_find_higher(context, context->runThread->priority);
+            thread_t* thread = context->runThread;
+            bool expired = thread->timeEnd < uptime;
+            thread_t* next = sched_context_find_deadline(context, thread);
+            if (next == NULL && !thread_is_deadline(thread))
+            {
+                next = expired ? sched_context_find_any(context) : sched_context_find_higher(context, thread->priority);
+            }
+
             if (next != NULL)
             {
-                thread_save(context->runThread, trapFrame);
-                sched_context_push(context, context->runThread);
+                // Yielding clears timeEnd.
+                if (thread->timeEnd == 0)
+                {
+                    thread->stats.voluntarySwitches++;
+                }
+                else
+                {
+                    thread->stats.preemptions++;
+                }
+                thread->stats.readyTime = uptime;
+
+                thread_save(thread, trapFrame);
+                sched_context_push(context, thread);
 
                 thread_load(next, trapFrame);
                 context->runThread = next;
             }
+            else if (expired && thread_is_deadline(thread))
+            {
+                thread->timeEnd = uptime + sched_deadline_slice(thread);
+            }
+            else if (expired)
+            {
+                // Nothing else wants to run, the thread continues with a new slice for its possibly demoted level.
+                thread->timeEnd = uptime + priority_time_slice(thread->priority) - thread->sliceUsed;
+            }
         }
     }
+
+    if (context->runThread != prev)
+    {
+        context->contextSwitches++;
+    }
+    sched_idle_update(self, uptime);
+
+#if CONFIG_SCHED_TICKLESS
+    sched_timer_arm(context);
+#endif
+
+    context->scheduleMax = MAX(context->scheduleMax, tsc_read() - start);
 }
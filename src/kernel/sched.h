@@ -4,6 +4,7 @@
 #include "lock.h"
 #include "queue.h"
 #include "thread.h"
+#include "wheel.h"
 
 #include <sys/list.h>
 
@@ -11,9 +12,14 @@
 #define SCHED_BLOCK(blocker, condition) \
     ({ \
         block_result_t result = BLOCK_NORM; \
-        while (!(condition) && result == BLOCK_NORM) \
+        while (result == BLOCK_NORM) \
         { \
-            result = sched_block(blocker, NEVER); \
+            uint64_t generation = blocker_generation(blocker); \
+            if (condition) \
+            { \
+                break; \
+            } \
+            result = sched_block_generation(blocker, generation, NEVER); \
         } \
         result; \
     })
@@ -25,43 +31,46 @@
         block_result_t result = BLOCK_NORM; \
         nsec_t uptime = time_uptime(); \
         nsec_t deadline = (timeout) == NEVER ? NEVER : (timeout) + uptime; \
-        while (!(condition) && result == BLOCK_NORM) \
+        while (result == BLOCK_NORM) \
         { \
+            uint64_t generation = blocker_generation(blocker); \
+            if (condition) \
+            { \
+                break; \
+            } \
             if (deadline < uptime) \
             { \
                 result = BLOCK_TIMEOUT; \
                 break; \
             } \
             nsec_t remaining = deadline == NEVER ? NEVER : (deadline > uptime ? deadline - uptime : 0); \
-            result = sched_block(blocker, remaining); \
+            result = sched_block_generation(blocker, generation, remaining); \
             uptime = time_uptime(); \
         } \
         result; \
     })
 
-// Blocks untill condition is true, condition will be tested after every call to sched_unblock.
-// When condition is tested it will also acquire lock, and the macro will always return with lock still acquired.
-#define SCHED_BLOCK_LOCK(blocker, lock, condition) \
+// Shared by SCHED_BLOCK_LOCK and SCHED_BLOCK_LOCK_EXCLUSIVE, block is the function used to block the thread.
+#define _SCHED_BLOCK_LOCK(blocker, lock, condition, block) \
     ({ \
         block_result_t result = BLOCK_NORM; \
         lock_acquire(lock); \
         while (result == BLOCK_NORM) \
         { \
+            uint64_t generation = blocker_generation(blocker); \
             if (condition) \
             { \
                 break; \
             } \
             lock_release(lock); \
-            result = sched_block(blocker, NEVER); \
+            result = block(blocker, generation, NEVER); \
             lock_acquire(lock); \
         } \
         result; \
     })
 
-// Blocks untill condition is true, condition will be tested after every call to sched_unblock.
-// When condition is tested it will also acquire lock, and the macro will always return with lock still acquired.
-// Will also return after timeout is reached, timeout will be reached even if sched_unblock is never called.
-#define SCHED_BLOCK_LOCK_TIMEOUT(blocker, lock, condition, timeout) \
+// Shared by SCHED_BLOCK_LOCK_TIMEOUT and SCHED_BLOCK_LOCK_TIMEOUT_EXCLUSIVE, block is the function used to block the thread.
+#define _SCHED_BLOCK_LOCK_TIMEOUT(blocker, lock, condition, timeout, block) \
     ({ \
         block_result_t result = BLOCK_NORM; \
         nsec_t uptime = time_uptime(); \
@@ -69,6 +78,7 @@
         lock_acquire(lock); \
         while (result == BLOCK_NORM) \
         { \
+            uint64_t generation = blocker_generation(blocker); \
             if (deadline < uptime) \
             { \
                 result = BLOCK_TIMEOUT; \
@@ -80,34 +90,100 @@
             } \
             lock_release(lock); \
             nsec_t remaining = deadline == NEVER ? NEVER : (deadline > uptime ? deadline - uptime : 0); \
-            result = sched_block(blocker, remaining); \
+            result = block(blocker, generation, remaining); \
             uptime = time_uptime(); \
             lock_acquire(lock); \
         } \
         result; \
     })
 
-typedef struct
-{
-    queue_t queues[PRIORITY_LEVELS];
-    list_t graveyard;
-    thread_t* runThread;
-} sched_context_t;
+// Blocks untill condition is true, condition will be tested after every call to sched_unblock.
+// When condition is tested it will also acquire lock, and the macro will always return with lock still acquired.
+#define SCHED_BLOCK_LOCK(blocker, lock, condition) _SCHED_BLOCK_LOCK(blocker, lock, condition, sched_block_generation)
 
+// Blocks untill condition is true, condition will be tested after every call to sched_unblock.
+// When condition is tested it will also acquire lock, and the macro will always return with lock still acquired.
+// Will also return after timeout is reached, timeout will be reached even if sched_unblock is never called.
+#define SCHED_BLOCK_LOCK_TIMEOUT(blocker, lock, condition, timeout) \
+    _SCHED_BLOCK_LOCK_TIMEOUT(blocker, lock, condition, timeout, sched_block_generation)
+
+// Same as SCHED_BLOCK_LOCK but waits as an exclusive waiter, see sched_block_exclusive().
+#define SCHED_BLOCK_LOCK_EXCLUSIVE(blocker, lock, condition) \
+    _SCHED_BLOCK_LOCK(blocker, lock, condition, sched_block_exclusive)
+
+// Same as SCHED_BLOCK_LOCK_TIMEOUT but waits as an exclusive waiter, see sched_block_exclusive().
+#define SCHED_BLOCK_LOCK_TIMEOUT_EXCLUSIVE(blocker, lock, condition, timeout) \
+    _SCHED_BLOCK_LOCK_TIMEOUT(blocker, lock, condition, timeout, sched_block_exclusive)
+
+// The generation is incremented by every unblock, a thread blocking on an older generation returns immediately so that
+// an unblock between testing a condition and blocking is never lost.
 typedef struct blocker
 {
-    list_entry_t entry;
     list_t threads;
+    atomic_uint64_t generation;
     lock_t lock;
 } blocker_t;
 
+// Fixed point scale of sched_context_t::loadAvg, a load of SCHED_LOAD_SCALE is one thread.
+#define SCHED_LOAD_SCALE 1024
+
+typedef struct
+{
+    queue_t queues[PRIORITY_LEVELS];
+    list_t deadlineQueue; // Ready deadline threads ordered by absolute deadline
+    list_t throttled;     // Deadline threads out of budget ordered by the start of their next period
+    lock_t deadlineLock;
+    atomic_uint64_t deadlineUtil; // Sum of the utilization of the deadline threads admitted to this cpu
+    uint64_t deadlineThrottles; // Budget used up before the thread yielded
+    uint64_t deadlineMisses;    // Period finished past its deadline
+    atomic_uint64_t readyAmount;
+    uint8_t probe;
+    wheel_t wheel;
+    uint64_t timerFrequency;
+    nsec_t timerDeadline;
+    uint64_t timeoutAmount;
+    nsec_t timeoutLatencyTotal;
+    nsec_t timeoutLatencyMax;
+    nsec_t boostDeadline;
+    atomic_uint64_t boostEpoch; // Incremented by every boost, queued threads from an older epoch are re-levelled lazily
+    nsec_t balanceDeadline;
+    uint64_t loadAvg;
+    uint64_t balanceRuns;
+    uint64_t balanceMovesOut;
+    uint64_t balanceMovesIn;
+    uint64_t steals;
+    list_t graveyard; // Threads that died while running here, their kernel stack is in use until the next schedule
+    list_t reapable;  // Dead threads waiting to be freed by the reaper of this cpu
+    lock_t reapLock;
+    blocker_t reaperBlocker;
+    uint64_t reaped;
+    uint64_t scheduleMax; // Longest sched_schedule() in tsc cycles
+    thread_t* runThread;
+    bool needResched;
+    bool idle;
+    atomic_uint64_t wake; // Monitored by the idle loop, a store to it wakes the cpu without an interrupt
+    uint64_t idleEntries;
+    uint64_t wakeStores;
+    uint64_t wakeIpis;
+    nsec_t idleStart;
+    nsec_t idleTime; // Excludes the current idle period
+    uint64_t contextSwitches;
+    uint64_t runqueueSamples; // One sample of readyAmount per schedule
+    uint64_t runqueueTotal;
+    uint64_t runqueueMax;
+} sched_context_t;
+
 void blocker_init(blocker_t* blocker);
 
 void blocker_cleanup(blocker_t* blocker);
 
+uint64_t blocker_generation(blocker_t* blocker);
+
 void sched_context_init(sched_context_t* context);
 
-extern void sched_idle_loop(void);
+// Runs on the idle stack of a cpu with nothing to run, waits in mwait on sched_context_t::wake if supported and hlt
+// otherwise.
+NORETURN void sched_idle_loop(void);
 
 void sched_init(void);
 
@@ -117,16 +193,49 @@ block_result_t sched_sleep(nsec_t timeout);
 
 block_result_t sched_block(blocker_t* blocker, nsec_t timeout);
 
+// Blocks unless the blocker has been unblocked since generation was retrieved with blocker_generation().
+block_result_t sched_block_generation(blocker_t* blocker, uint64_t generation, nsec_t timeout);
+
+// Same as sched_block_generation() but the thread is an exclusive waiter, exclusive waiters are woken in the order they
+// blocked and only as many as requested by sched_unblock_one() or sched_unblock_n(). Meant for blockers where only one
+// waiter can make progress per event, a waiter that is woken but gives up without consuming the event should pass it on
+// with sched_unblock_one().
+block_result_t sched_block_exclusive(blocker_t* blocker, uint64_t generation, nsec_t timeout);
+
+// Unblocks all threads.
 void sched_unblock(blocker_t* blocker);
 
+// Unblocks all non-exclusive threads and at most one exclusive thread.
+void sched_unblock_one(blocker_t* blocker);
+
+// Unblocks all non-exclusive threads and at most amount exclusive threads, returns the total amount of threads unblocked.
+uint64_t sched_unblock_n(blocker_t* blocker, uint64_t amount);
+
 thread_t* sched_thread(void);
 
 process_t* sched_process(void);
 
 void sched_invoke(void);
 
+// Invokes the scheduler only if a thread that should preempt the running thread was pushed to this cpu.
+void sched_invoke_if_needed(void);
+
 void sched_yield(void);
 
+// Sets the base priority of the running thread to PRIORITY_USER - nice, the thread is moved to its new base priority
+// immediately.
+uint64_t sched_nice(int64_t nice);
+
+// Restricts the running thread to the cpus in mask, the thread is moved right away if it is running on a cpu that is no
+// longer allowed.
+uint64_t sched_affinity(cpumask_t mask);
+
+// Makes the running thread a deadline thread that is given runtime within deadline of the start of every period, or a
+// normal thread again if runtime is 0. Admission control places the thread on the cpu with the least reserved
+// utilization that stays below CONFIG_SCHED_DEADLINE_UTIL percent and pins it there, the call fails with EBUSY if no
+// allowed cpu has room. Yielding gives up the rest of the budget until the next period.
+uint64_t sched_deadline(nsec_t runtime, nsec_t period, nsec_t deadline);
+
 NORETURN void sched_process_exit(uint64_t status);
 
 NORETURN void sched_thread_exit(void);
@@ -0,0 +1,64 @@
+#include "semaphore.h"
+
+#include "time.h"
+
+void semaphore_init(semaphore_t* semaphore, uint64_t count)
+{
+    atomic_init(&semaphore->count, count);
+    blocker_init(&semaphore->blocker);
+}
+
+void semaphore_acquire(semaphore_t* semaphore)
+{
+    semaphore_acquire_timeout(semaphore, NEVER);
+}
+
+block_result_t semaphore_acquire_timeout(semaphore_t* semaphore, nsec_t timeout)
+{
+    nsec_t deadline = timeout == NEVER ? NEVER : time_uptime() + timeout;
+    while (1)
+    {
+        uint64_t generation = blocker_generation(&semaphore->blocker);
+        if (semaphore_try_acquire(semaphore))
+        {
+            return BLOCK_NORM;
+        }
+
+        nsec_t uptime = time_uptime();
+        if (deadline <= uptime)
+        {
+            return BLOCK_TIMEOUT;
+        }
+
+        nsec_t remaining = deadline == NEVER ? NEVER : deadline - uptime;
+        if (sched_block_exclusive(&semaphore->blocker, generation, remaining) == BLOCK_TIMEOUT)
+        {
+            // A release might have picked this thread just as it timed out, it must not be lost.
+            if (semaphore_try_acquire(semaphore))
+            {
+                return BLOCK_NORM;
+            }
+            return BLOCK_TIMEOUT;
+        }
+    }
+}
+
+bool semaphore_try_acquire(semaphore_t* semaphore)
+{
+    uint64_t count = atomic_load(&semaphore->count);
+    while (count != 0)
+    {
+        if (atomic_compare_exchange_weak(&semaphore->count, &count, count - 1))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void semaphore_release(semaphore_t* semaphore, uint64_t amount)
+{
+    atomic_fetch_add(&semaphore->count, amount);
+    sched_unblock_n(&semaphore->blocker, amount);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "defs.h"
+#include "sched.h"
+
+// Counting semaphore, acquiring blocks while the count is zero. Must only be acquired where blocking is allowed, but
+// can be released from anywhere.
+typedef struct
+{
+    atomic_uint64_t count;
+    blocker_t blocker;
+} semaphore_t;
+
+void semaphore_init(semaphore_t* semaphore, uint64_t count);
+
+void semaphore_acquire(semaphore_t* semaphore);
+
+// Returns BLOCK_TIMEOUT if the count stayed zero for the entire timeout.
+block_result_t semaphore_acquire_timeout(semaphore_t* semaphore, nsec_t timeout);
+
+bool semaphore_try_acquire(semaphore_t* semaphore);
+
+void semaphore_release(semaphore_t* semaphore, uint64_t amount);
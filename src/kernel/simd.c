@@ -1,13 +1,24 @@
 #include "simd.h"
 #include "cpuid.h"
+#include "lock.h"
+#include "log.h"
 #include "pmm.h"
 #include "regs.h"
 #include "vmm.h"
 
 #include <stdint.h>
 #include <string.h>
+#include <sys/math.h>
 
-static uint8_t initContext[PAGE_SIZE] ALIGNED(64);
+static uint8_t initContext[PAGE_SIZE] ALIGNED(SIMD_AREA_ALIGNMENT);
+
+static bool xsaveAvail;
+static bool xsaveoptAvail;
+static uint64_t areaSize;
+
+// Save areas are much smaller than a page, so they are carved out of pages and kept on a free list.
+static void* freeAreas;
+static lock_t cacheLock;
 
 static void simd_xsave_init(void)
 {
@@ -30,60 +41,152 @@ static void simd_xsave_init(void)
     xcr0_write(0, xcr0);
 }
 
+static void simd_save(uint8_t* buffer)
+{
+    if (xsaveoptAvail)
+    {
+        asm volatile("xsaveopt %0" : : "m"(*buffer), "a"(UINT64_MAX), "d"(UINT64_MAX) : "memory");
+    }
+    else if (xsaveAvail)
+    {
+        asm volatile("xsave %0" : : "m"(*buffer), "a"(UINT64_MAX), "d"(UINT64_MAX) : "memory");
+    }
+    else
+    {
+        asm volatile("fxsave (%0)" : : "r"(buffer));
+    }
+}
+
+static void simd_restore(uint8_t* buffer)
+{
+    if (xsaveAvail)
+    {
+        asm volatile("xrstor %0" : : "m"(*buffer), "a"(UINT64_MAX), "d"(UINT64_MAX) : "memory");
+    }
+    else
+    {
+        asm volatile("fxrstor (%0)" : : "r"(buffer));
+    }
+}
+
+static uint8_t* simd_area_alloc(void)
+{
+    LOCK_GUARD(&cacheLock);
+
+    if (freeAreas == NULL)
+    {
+        uint8_t* page = pmm_alloc();
+        for (uint64_t offset = 0; offset + areaSize <= PAGE_SIZE; offset += areaSize)
+        {
+            *(void**)(page + offset) = freeAreas;
+            freeAreas = page + offset;
+        }
+    }
+
+    uint8_t* area = freeAreas;
+    freeAreas = *(void**)area;
+    return area;
+}
+
+static void simd_area_free(uint8_t* area)
+{
+    LOCK_GUARD(&cacheLock);
+
+    *(void**)area = freeAreas;
+    freeAreas = area;
+}
+
 void simd_init(void)
 {
-    cr0_write(cr0_read() & ~((uint64_t)CR0_EMULATION));
+    cr0_write(cr0_read() & ~((uint64_t)(CR0_EMULATION | CR0_TASK_SWITCHED)));
     cr0_write(cr0_read() | CR0_MONITOR_CO_PROCESSOR | CR0_NUMERIC_ERROR_ENABLE);
 
     cr4_write(cr4_read() | CR4_FXSR_ENABLE | CR4_SIMD_EXCEPTION);
 
-    if (cpuid_xsave_avail())
+    xsaveAvail = cpuid_xsave_avail();
+    if (xsaveAvail)
     {
         simd_xsave_init();
     }
 
-    asm volatile("fninit");
-    if (cpuid_xsave_avail())
+    // The bootstrap cpu sets up the shared state, all cpus are expected to support the same features.
+    if (areaSize == 0)
     {
-        asm volatile("xsave %0" : : "m"(*initContext), "a"(UINT64_MAX), "d"(UINT64_MAX) : "memory");
+        xsaveoptAvail = xsaveAvail && cpuid_xsaveopt_avail();
+        areaSize = ROUND_UP(xsaveAvail ? cpuid_xsave_size() : 512, SIMD_AREA_ALIGNMENT);
+        LOG_ASSERT(areaSize <= PAGE_SIZE, "simd area too large");
+
+        freeAreas = NULL;
+        lock_init(&cacheLock);
+
+        asm volatile("fninit");
+        if (xsaveAvail)
+        {
+            asm volatile("xsave %0" : : "m"(*initContext), "a"(UINT64_MAX), "d"(UINT64_MAX) : "memory");
+        }
+        else
+        {
+            asm volatile("fxsave (%0)" : : "r"(initContext));
+        }
     }
     else
     {
-        asm volatile("fxsave (%0)" : : "r"(initContext));
+        asm volatile("fninit");
     }
 }
 
 void simd_context_init(simd_context_t* context)
 {
-    context->buffer = pmm_alloc();
-    memcpy(context->buffer, initContext, PAGE_SIZE);
+    context->buffer = NULL;
 }
 
 void simd_context_cleanup(simd_context_t* context)
 {
-    pmm_free(context->buffer);
+    if (context->buffer != NULL)
+    {
+        simd_area_free(context->buffer);
+        context->buffer = NULL;
+    }
 }
 
 void simd_context_save(simd_context_t* context)
 {
-    if (cpuid_xsave_avail())
+    if (context->buffer != NULL)
     {
-        asm volatile("xsave %0" : : "m"(*context->buffer), "a"(UINT64_MAX), "d"(UINT64_MAX) : "memory");
-    }
-    else
-    {
-        asm volatile("fxsave (%0)" : : "r"(context->buffer));
+        simd_save(context->buffer);
     }
 }
 
 void simd_context_load(simd_context_t* context)
 {
-    if (cpuid_xsave_avail())
+    uint64_t cr0 = cr0_read();
+    if (context->buffer == NULL)
     {
-        asm volatile("xrstor %0" : : "m"(*context->buffer), "a"(UINT64_MAX), "d"(UINT64_MAX) : "memory");
+        // A clear CR0.TS means the registers still hold the state of another thread, which is wiped before the
+        // thread that will trap on first use is allowed to run.
+        if (!(cr0 & CR0_TASK_SWITCHED))
+        {
+            simd_restore(initContext);
+            cr0_write(cr0 | CR0_TASK_SWITCHED);
+        }
+        return;
     }
-    else
+
+    if (cr0 & CR0_TASK_SWITCHED)
+    {
+        asm volatile("clts");
+    }
+    simd_restore(context->buffer);
+}
+
+void simd_context_fault(simd_context_t* context)
+{
+    asm volatile("clts");
+
+    if (context->buffer == NULL)
     {
-        asm volatile("fxrstor (%0)" : : "r"(context->buffer));
+        context->buffer = simd_area_alloc();
+        memcpy(context->buffer, initContext, areaSize);
     }
+    simd_restore(context->buffer);
 }
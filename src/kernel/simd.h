@@ -2,6 +2,9 @@
 
 #include "defs.h"
 
+#define SIMD_AREA_ALIGNMENT 64
+
+// The buffer is only allocated once the thread first uses simd, until then the thread runs with CR0.TS set.
 typedef struct
 {
     uint8_t* buffer;
@@ -16,3 +19,6 @@ void simd_context_cleanup(simd_context_t* context);
 void simd_context_save(simd_context_t* context);
 
 void simd_context_load(simd_context_t* context);
+
+// Allocates and loads the simd state of the running thread, called from the device not available exception.
+void simd_context_fault(simd_context_t* context);
@@ -0,0 +1,311 @@
+#include "slab.h"
+
+#include "log.h"
+#include "pmm.h"
+#include "sysfs.h"
+
+#include <stdlib.h>
+#include <sys/math.h>
+
+// Placed at the start of the pages of every slab, followed by the objects at cache->headerSize.
+typedef struct
+{
+    list_entry_t entry;
+    uint64_t freeAmount;
+    uint16_t free[]; // Indices of the free objects, kept outside of the objects so that they keep their state
+} slab_t;
+
+static list_t caches = {.head = {.prev = &caches.head, .next = &caches.head}};
+static lock_t cachesLock;
+
+static uint64_t slab_header_size(uint64_t objects)
+{
+    return ROUND_UP(sizeof(slab_t) + objects * sizeof(uint16_t), SLAB_ALIGNMENT);
+}
+
+// Doubles the slab size until at least SLAB_MIN_OBJECTS objects fit, called with the cache lock held.
+static void slab_cache_setup(slab_cache_t* cache)
+{
+    cache->objectSize = ROUND_UP(cache->objectSize, SLAB_ALIGNMENT);
+    cache->slabPages = 1;
+    while (true)
+    {
+        uint64_t bytes = cache->slabPages * PAGE_SIZE;
+        uint64_t objects = (bytes - sizeof(slab_t)) / (cache->objectSize + sizeof(uint16_t));
+        while (objects != 0 && slab_header_size(objects) + objects * cache->objectSize > bytes)
+        {
+            objects--;
+        }
+
+        if (objects >= SLAB_MIN_OBJECTS || cache->slabPages == 1ULL << PMM_ORDER_MAX)
+        {
+            LOG_ASSERT(objects != 0, "slab object too large");
+            cache->slabObjects = objects;
+            cache->headerSize = slab_header_size(objects);
+            break;
+        }
+        cache->slabPages *= 2;
+    }
+
+    list_entry_init(&cache->entry);
+    list_init(&cache->partial);
+    list_init(&cache->full);
+    list_init(&cache->empty);
+    cache->slabAmount = 0;
+    cache->active = 0;
+    cache->ready = true;
+
+    LOCK_GUARD(&cachesLock);
+    list_push(&caches, cache);
+}
+
+static void* slab_object(const slab_cache_t* cache, slab_t* slab, uint64_t index)
+{
+    return (void*)((uint64_t)slab + cache->headerSize + index * cache->objectSize);
+}
+
+static slab_t* slab_new(slab_cache_t* cache)
+{
+    slab_t* slab = pmm_alloc_pages(cache->slabPages);
+    if (slab == NULL)
+    {
+        return NULL;
+    }
+    list_entry_init(&slab->entry);
+
+    // Handed out in address order.
+    slab->freeAmount = cache->slabObjects;
+    for (uint64_t i = 0; i < cache->slabObjects; i++)
+    {
+        slab->free[i] = cache->slabObjects - 1 - i;
+        if (cache->ctor != NULL)
+        {
+            cache->ctor(slab_object(cache, slab, i));
+        }
+    }
+
+    cache->slabAmount++;
+    return slab;
+}
+
+// Called with the cache lock held.
+static void* slab_take(slab_cache_t* cache)
+{
+    if (!cache->ready)
+    {
+        slab_cache_setup(cache);
+    }
+
+    slab_t* slab = list_first(&cache->partial);
+    if (slab == NULL)
+    {
+        slab = list_pop(&cache->empty);
+        if (slab == NULL)
+        {
+            slab = slab_new(cache);
+            if (slab == NULL)
+            {
+                return NULL;
+            }
+        }
+        list_push(&cache->partial, slab);
+    }
+
+    void* object = slab_object(cache, slab, slab->free[--slab->freeAmount]);
+    if (slab->freeAmount == 0)
+    {
+        list_remove(slab);
+        list_push(&cache->full, slab);
+    }
+
+    cache->active++;
+    return object;
+}
+
+// Called with the cache lock held.
+static void slab_put(slab_cache_t* cache, void* object)
+{
+    slab_t* slab = (slab_t*)ROUND_DOWN((uint64_t)object, cache->slabPages * PAGE_SIZE);
+    uint64_t index = ((uint64_t)object - (uint64_t)slab - cache->headerSize) / cache->objectSize;
+    LOG_ASSERT(index < cache->slabObjects && slab_object(cache, slab, index) == object, "invalid slab free");
+
+    if (slab->freeAmount == 0)
+    {
+        list_remove(slab);
+        list_push(&cache->partial, slab);
+    }
+    slab->free[slab->freeAmount++] = index;
+    cache->active--;
+
+    if (slab->freeAmount == cache->slabObjects)
+    {
+        list_remove(slab);
+        // Keeping one empty slab stops a cache that hovers around a slab boundary from freeing and allocating pages
+        // over and over.
+        if (list_empty(&cache->empty))
+        {
+            list_push(&cache->empty, slab);
+        }
+        else
+        {
+            pmm_free_pages(slab, cache->slabPages);
+            cache->slabAmount--;
+        }
+    }
+}
+
+static slab_magazine_t* slab_magazine(slab_cache_t* cache, const cpu_t* self)
+{
+    slab_magazine_t* magazine = cache->magazines[self->id];
+    if (magazine == NULL)
+    {
+        magazine = calloc(1, sizeof(slab_magazine_t));
+        cache->magazines[self->id] = magazine;
+    }
+
+    return magazine;
+}
+
+void* slab_alloc(slab_cache_t* cache)
+{
+    // The magazines are only used once every cpu is running.
+    if (!smp_initialized())
+    {
+        LOCK_GUARD(&cache->lock);
+        return slab_take(cache);
+    }
+
+    slab_magazine_t* magazine = slab_magazine(cache, smp_self());
+    if (magazine == NULL)
+    {
+        smp_put();
+        LOCK_GUARD(&cache->lock);
+        return slab_take(cache);
+    }
+
+    if (magazine->count == 0)
+    {
+        LOCK_GUARD(&cache->lock);
+        while (magazine->count < SLAB_MAGAZINE_SIZE / 2)
+        {
+            void* object = slab_take(cache);
+            if (object == NULL)
+            {
+                break;
+            }
+            magazine->objects[magazine->count++] = object;
+        }
+    }
+
+    void* object = magazine->count != 0 ? magazine->objects[--magazine->count] : NULL;
+    magazine->allocs++;
+    smp_put();
+
+    return object;
+}
+
+void slab_free(slab_cache_t* cache, void* object)
+{
+    if (!smp_initialized())
+    {
+        LOCK_GUARD(&cache->lock);
+        slab_put(cache, object);
+        return;
+    }
+
+    slab_magazine_t* magazine = slab_magazine(cache, smp_self());
+    if (magazine == NULL)
+    {
+        smp_put();
+        LOCK_GUARD(&cache->lock);
+        slab_put(cache, object);
+        return;
+    }
+
+    if (magazine->count == SLAB_MAGAZINE_SIZE)
+    {
+        LOCK_GUARD(&cache->lock);
+        while (magazine->count > SLAB_MAGAZINE_SIZE / 2)
+        {
+            slab_put(cache, magazine->objects[--magazine->count]);
+        }
+    }
+
+    magazine->objects[magazine->count++] = object;
+    magazine->frees++;
+    smp_put();
+}
+
+typedef struct
+{
+    const char* name;
+    uint64_t objectSize;
+    uint64_t slabPages;
+    uint64_t slabAmount;
+    uint64_t active;
+    uint64_t cached;
+    uint64_t allocs;
+    uint64_t frees;
+} slab_stats_t;
+
+static void slab_print(sysfs_text_t* text, void* private)
+{
+    // Printing can allocate, so the counters are taken before. Caches are never removed, they are only added at the end
+    // of the list, so the ones counted are the ones copied.
+    uint64_t amount = 0;
+    lock_acquire(&cachesLock);
+    slab_cache_t* cache;
+    LIST_FOR_EACH(cache, &caches)
+    {
+        amount++;
+    }
+    lock_release(&cachesLock);
+
+    slab_stats_t* stats = calloc(amount, sizeof(slab_stats_t));
+    if (stats == NULL && amount != 0)
+    {
+        return;
+    }
+
+    uint64_t index = 0;
+    lock_acquire(&cachesLock);
+    LIST_FOR_EACH(cache, &caches)
+    {
+        if (index == amount)
+        {
+            break;
+        }
+
+        slab_stats_t* stat = &stats[index++];
+        stat->name = cache->name;
+        stat->objectSize = cache->objectSize;
+        stat->slabPages = cache->slabPages;
+        stat->slabAmount = cache->slabAmount;
+        stat->active = cache->active;
+        for (uint64_t i = 0; i < CPU_MAX_AMOUNT; i++)
+        {
+            const slab_magazine_t* magazine = cache->magazines[i];
+            if (magazine != NULL)
+            {
+                stat->cached += magazine->count;
+                stat->allocs += magazine->allocs;
+                stat->frees += magazine->frees;
+            }
+        }
+    }
+    lock_release(&cachesLock);
+
+    sysfs_text_print(text, "name object_size slab_pages slabs in_use cached allocs frees\n");
+    for (uint64_t i = 0; i < amount; i++)
+    {
+        const slab_stats_t* stat = &stats[i];
+        sysfs_text_print(text, "%s %d %d %d %d %d %d %d\n", stat->name, stat->objectSize, stat->slabPages,
+            stat->slabAmount, stat->active - stat->cached, stat->cached, stat->allocs, stat->frees);
+    }
+    free(stats);
+}
+
+void slab_expose_stats(void)
+{
+    sysfs_expose_text("/stats", "slab", slab_print, NULL);
+}
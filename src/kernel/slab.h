@@ -0,0 +1,58 @@
+#pragma once
+
+#include "defs.h"
+#include "lock.h"
+#include "smp.h"
+
+#include <sys/list.h>
+
+// Objects are aligned to a cache line.
+#define SLAB_ALIGNMENT 64
+
+// Slabs are made large enough to hold at least this many objects.
+#define SLAB_MIN_OBJECTS 8
+
+#define SLAB_MAGAZINE_SIZE 16
+
+typedef void (*slab_ctor_t)(void* object);
+
+// Free objects of one cache owned by one cpu, only accessed by that cpu with interrupts disabled. An empty magazine is
+// refilled and a full one drained by half of SLAB_MAGAZINE_SIZE under the cache lock.
+typedef struct
+{
+    void* objects[SLAB_MAGAZINE_SIZE];
+    uint64_t count;
+    uint64_t allocs;
+    uint64_t frees;
+} slab_magazine_t;
+
+// Object cache for one type, objects are carved from naturally aligned runs of pages so the slab of an object is found
+// by rounding its address down. The constructor runs once for every object when its slab is created, a freed object
+// keeps the state it was freed in. Set up on first use, see SLAB_CACHE_INIT.
+typedef struct slab_cache
+{
+    list_entry_t entry;
+    const char* name;
+    uint64_t objectSize;
+    slab_ctor_t ctor;
+    bool ready;
+    uint64_t slabPages;
+    uint64_t slabObjects;
+    uint64_t headerSize;
+    lock_t lock;
+    list_t partial;
+    list_t full;
+    list_t empty; // At most one slab is kept empty
+    uint64_t slabAmount;
+    uint64_t active; // Objects taken out of slabs, including the ones held in magazines
+    slab_magazine_t* magazines[CPU_MAX_AMOUNT]; // Allocated the first time a cpu uses the cache
+} slab_cache_t;
+
+#define SLAB_CACHE_INIT(type, constructor) {.name = #type, .objectSize = sizeof(type), .ctor = (constructor)}
+
+void* slab_alloc(slab_cache_t* cache);
+
+void slab_free(slab_cache_t* cache, void* object);
+
+// Exposes sys:/stats/slab, the usage of every cache.
+void slab_expose_stats(void);
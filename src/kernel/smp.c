@@ -9,6 +9,7 @@
 #include "madt.h"
 #include "regs.h"
 #include "sched.h"
+#include "syscall.h"
 #include "trampoline.h"
 #include "trap.h"
 #include "vmm.h"
@@ -25,41 +26,39 @@ static bool initialized = false;
 
 atomic_uint8_t haltedAmount = ATOMIC_VAR_INIT(0);
 
-static void ipi_queue_init(ipi_queue_t* queue)
-{
-    queue->readIndex = 0;
-    queue->writeIndex = 0;
-    lock_init(&queue->lock);
-}
-
-static void ipi_queue_push(ipi_queue_t* queue, ipi_t ipi)
-{
-    queue->ipis[queue->writeIndex] = ipi;
-    queue->writeIndex = (queue->writeIndex + 1) % IPI_QUEUE_MAX;
-}
-
-static ipi_t ipi_queue_pop(ipi_queue_t* queue)
-{
-    if (queue->writeIndex == queue->readIndex)
-    {
-        return NULL;
-    }
-
-    ipi_t ipi = queue->ipis[queue->readIndex];
-    queue->readIndex = (queue->readIndex + 1) % IPI_QUEUE_MAX;
-    return ipi;
-}
+static smp_call_t haltCalls[CPU_MAX_AMOUNT];
 
 static NOINLINE void cpu_init(cpu_t* cpu, uint8_t id, uint8_t lapicId)
 {
+    cpu->self = cpu;
+    cpu->kernelRsp = 0;
+    cpu->userRsp = 0;
     cpu->id = id;
     cpu->lapicId = lapicId;
     cpu->trapDepth = 0;
     cpu->prevFlags = 0;
     cpu->cliAmount = 0;
+    cpu->cliStart = 0;
+    cpu->cliMax = 0;
+    cpu->tlsBase = NULL;
+    cpu->timerInterrupts = 0;
     tss_init(&cpu->tss);
     sched_context_init(&cpu->sched);
-    ipi_queue_init(&cpu->queue);
+    atomic_init(&cpu->calls.head, NULL);
+    atomic_init(&cpu->space, NULL);
+    space_pcid_cache_init(&cpu->pcid);
+    pmm_cache_init(&cpu->pageCache);
+    atomic_init(&cpu->lockNode.next, NULL);
+    atomic_init(&cpu->lockNode.first, false);
+}
+
+// The kernel gs base is swapped with the user gs base on every transition to and from user space.
+static void cpu_load(cpu_t* cpu)
+{
+    msr_write(MSR_GS_BASE, (uint64_t)cpu);
+    msr_write(MSR_KERNEL_GS_BASE, 0);
+    msr_write(MSR_FS_BASE, (uint64_t)cpu->tlsBase);
+    gdt_load_tss(&cpu->tss);
 }
 
 static NOINLINE uint64_t cpu_start(cpu_t* cpu)
@@ -133,8 +132,7 @@ void smp_init(void)
     cpus[0] = malloc(sizeof(cpu_t));
     cpu_init(cpus[0], 0, 0);
 
-    msr_write(MSR_CPU_ID, cpus[0]->id);
-    gdt_load_tss(&cpus[0]->tss);
+    cpu_load(cpus[0]);
 
     log_print("smp: init self");
 }
@@ -157,11 +155,11 @@ void smp_entry(void)
     idt_init();
 
     cpu_t* cpu = smp_self_brute();
-    msr_write(MSR_CPU_ID, cpu->id);
-    gdt_load_tss(&cpu->tss);
+    cpu_load(cpu);
 
     lapic_init();
     simd_init();
+    syscall_init();
 
     vmm_cpu_init();
 
@@ -176,7 +174,7 @@ bool smp_initialized(void)
     return initialized;
 }
 
-static void smp_halt_ipi(trap_frame_t* trapFrame)
+static void smp_halt_call(void* private)
 {
     atomic_fetch_add(&haltedAmount, 1);
 
@@ -187,9 +185,18 @@ static void smp_halt_ipi(trap_frame_t* trapFrame)
     }
 }
 
+// Uses preallocated calls as the heap may be in an unknown state when halting due to a panic.
 void smp_halt_others(void)
 {
-    smp_send_others(smp_halt_ipi);
+    const cpu_t* self = smp_self_unsafe();
+    for (uint8_t id = 0; id < cpuAmount; id++)
+    {
+        if (self->id != id)
+        {
+            haltCalls[id] = (smp_call_t){.func = smp_halt_call};
+            smp_call_queue(cpus[id], &haltCalls[id]);
+        }
+    }
 
     while (atomic_load(&haltedAmount) < cpuAmount - 1)
     {
@@ -197,49 +204,152 @@ void smp_halt_others(void)
     }
 }
 
-ipi_t smp_recieve(cpu_t* cpu)
+void smp_mask_all(smp_mask_t* mask)
+{
+    memset(mask, 0, sizeof(smp_mask_t));
+    for (uint8_t id = 0; id < cpuAmount; id++)
+    {
+        smp_mask_set(mask, id);
+    }
+}
+
+void smp_call_queue(cpu_t* cpu, smp_call_t* call)
+{
+    smp_call_t* head = atomic_load(&cpu->calls.head);
+    do
+    {
+        call->next = head;
+    } while (!atomic_compare_exchange_weak(&cpu->calls.head, &head, call));
+
+    // A non empty queue means an interrupt is already on its way and has not yet taken the calls.
+    if (head == NULL)
+    {
+        lapic_send_ipi(cpu->lapicId, VECTOR_IPI);
+    }
+}
+
+void smp_call_process(cpu_t* cpu)
 {
-    ipi_queue_t* queue = &cpu->queue;
+    smp_call_t* stack = atomic_exchange(&cpu->calls.head, NULL);
+
+    smp_call_t* calls = NULL;
+    while (stack != NULL)
+    {
+        smp_call_t* next = stack->next;
+        stack->next = calls;
+        calls = stack;
+        stack = next;
+    }
+
+    while (calls != NULL)
+    {
+        // The sender may reuse the call as soon as pending is decremented.
+        smp_call_t* next = calls->next;
+        atomic_uint64_t* pending = calls->pending;
 
-    lock_acquire(&queue->lock);
-    ipi_t ipi = ipi_queue_pop(queue);
-    lock_release(&queue->lock);
+        calls->func(calls->private);
 
-    return ipi;
+        if (calls->owned)
+        {
+            free(calls);
+        }
+        if (pending != NULL)
+        {
+            atomic_fetch_sub(pending, 1);
+        }
+        calls = next;
+    }
 }
 
-void smp_send(cpu_t* cpu, ipi_t ipi)
+// Waits for synchronous calls while running calls sent to this cpu, two cpus calling each other would otherwise
+// deadlock as both have interrupts disabled.
+static void smp_call_wait(cpu_t* self, atomic_uint64_t* pending)
 {
-    ipi_queue_t* queue = &cpu->queue;
+    while (atomic_load(pending) != 0)
+    {
+        smp_call_process(self);
+        asm volatile("pause");
+    }
+}
 
-    lock_acquire(&queue->lock);
-    ipi_queue_push(queue, ipi);
-    lock_release(&queue->lock);
+void smp_call(cpu_t* cpu, smp_func_t func, void* private)
+{
+    smp_mask_t mask = {0};
+    smp_mask_set(&mask, cpu->id);
+    smp_call_mask(&mask, func, private);
+}
 
-    lapic_send_ipi(cpu->lapicId, VECTOR_IPI);
+uint64_t smp_call_async(cpu_t* cpu, smp_func_t func, void* private)
+{
+    smp_mask_t mask = {0};
+    smp_mask_set(&mask, cpu->id);
+    return smp_call_mask_async(&mask, func, private);
 }
 
-void smp_send_self(ipi_t ipi)
+void smp_call_mask(const smp_mask_t* mask, smp_func_t func, void* private)
 {
-    ipi_queue_t* queue = &smp_self_unsafe()->queue;
+    cpu_t* self = smp_self();
+
+    atomic_uint64_t pending = ATOMIC_VAR_INIT(0);
+    for (uint8_t id = 0; id < cpuAmount; id++)
+    {
+        if (id == self->id || !smp_mask_test(mask, id))
+        {
+            continue;
+        }
+
+        smp_call_t* call = &self->syncCalls[id];
+        call->func = func;
+        call->private = private;
+        call->pending = &pending;
+        call->owned = false;
 
-    lock_acquire(&queue->lock);
-    ipi_queue_push(queue, ipi);
-    lock_release(&queue->lock);
+        atomic_fetch_add(&pending, 1);
+        smp_call_queue(cpus[id], call);
+    }
 
-    asm volatile("int %0" ::"i"(VECTOR_IPI));
+    if (smp_mask_test(mask, self->id))
+    {
+        func(private);
+    }
+
+    smp_call_wait(self, &pending);
+    smp_put();
 }
 
-void smp_send_others(ipi_t ipi)
+uint64_t smp_call_mask_async(const smp_mask_t* mask, smp_func_t func, void* private)
 {
-    const cpu_t* self = smp_self_unsafe();
+    cpu_t* self = smp_self();
+
+    uint64_t result = 0;
     for (uint8_t id = 0; id < cpuAmount; id++)
     {
-        if (self->id != id)
+        if (id == self->id || !smp_mask_test(mask, id))
+        {
+            continue;
+        }
+
+        smp_call_t* call = malloc(sizeof(smp_call_t));
+        if (call == NULL)
         {
-            smp_send(cpus[id], ipi);
+            result = ERROR(ENOMEM);
+            continue;
         }
+        call->func = func;
+        call->private = private;
+        call->pending = NULL;
+        call->owned = true;
+
+        smp_call_queue(cpus[id], call);
+    }
+
+    if (smp_mask_test(mask, self->id))
+    {
+        func(private);
     }
+
+    smp_put();
+    return result;
 }
 
 uint8_t smp_cpu_amount(void)
@@ -247,6 +357,11 @@ uint8_t smp_cpu_amount(void)
     return cpuAmount;
 }
 
+bool smp_mask_valid(cpumask_t mask)
+{
+    return cpuAmount >= 64 ? mask != 0 : (mask & ((1ULL << cpuAmount) - 1)) != 0;
+}
+
 cpu_t* smp_cpu(uint8_t id)
 {
     return cpus[id];
@@ -256,7 +371,7 @@ cpu_t* smp_self_unsafe(void)
 {
     LOG_ASSERT((rflags_read() & RFLAGS_INTERRUPT_ENABLE) == 0, "smp_self_unsafe called with interrupts enabled");
 
-    return cpus[msr_read(MSR_CPU_ID)];
+    return SMP_SELF_READ(self);
 }
 
 cpu_t* smp_self_brute(void)
@@ -279,7 +394,7 @@ cpu_t* smp_self(void)
 {
     cli_push();
 
-    return cpus[msr_read(MSR_CPU_ID)];
+    return SMP_SELF_READ(self);
 }
 
 void smp_put(void)
@@ -3,37 +3,82 @@
 #include "defs.h"
 #include "pmm.h"
 #include "sched.h"
+#include "space.h"
 #include "trap.h"
 #include "tss.h"
 
 #define CPU_MAX_AMOUNT 255
 #define CPU_IDLE_STACK_SIZE PAGE_SIZE
 
-#define IPI_QUEUE_MAX 4
-
-typedef void (*ipi_t)(trap_frame_t*);
+typedef void (*smp_func_t)(void* private);
 
+// A function call queued on another cpu, calls are always run with interrupts disabled and must not make synchronous
+// calls themselves.
+typedef struct smp_call
+{
+    struct smp_call* next;
+    smp_func_t func;
+    void* private;
+    atomic_uint64_t* pending; // Decremented once func has returned, may be NULL
+    bool owned;               // Freed by the receiving cpu once func has returned
+} smp_call_t;
+
+// Lock free multiple producer single consumer stack, the receiving cpu takes every call at once and runs them in the
+// order they were pushed.
 typedef struct
 {
-    ipi_t ipis[IPI_QUEUE_MAX];
-    uint8_t readIndex;
-    uint8_t writeIndex;
-    lock_t lock;
-} ipi_queue_t;
+    _Atomic(smp_call_t*) head;
+} smp_call_queue_t;
+
+#define SMP_MASK_WORDS ((CPU_MAX_AMOUNT + 63) / 64)
 
 typedef struct
 {
+    uint64_t bits[SMP_MASK_WORDS];
+} smp_mask_t;
+
+// While in kernel space the gs base always points to the cpu_t of the running cpu, the first fields are accessed
+// through gs by assembly, see syscall.s before reordering them.
+typedef struct cpu
+{
+    struct cpu* self;
+    uint64_t kernelRsp;
+    uint64_t userRsp;
     uint8_t id;
     uint8_t lapicId;
     uint64_t trapDepth;
     uint64_t prevFlags;
     uint64_t cliAmount;
+    uint64_t timerInterrupts;
     tss_t tss;
     sched_context_t sched;
-    ipi_queue_t queue;
+    smp_call_queue_t calls;
+    smp_call_t syncCalls[CPU_MAX_AMOUNT]; // Used by this cpu for synchronous calls, one per target
+    _Atomic(space_t*) space;              // The loaded address space, NULL for the kernel space
+    pcid_cache_t pcid;
+    pmm_cache_t pageCache;
+    lock_node_t lockNode;
+    uint64_t cliStart; // Tsc when interrupts were last disabled by cli_push()
+    uint64_t cliMax;   // Longest time in tsc cycles that cli_push() kept interrupts disabled, see CONFIG_IRQ_OFF_STATS
+    void* tlsBase;     // Last value written to the fs base msr
     uint8_t idleStack[CPU_IDLE_STACK_SIZE];
 } cpu_t;
 
+// Reads a member of the running cpus cpu_t with a single gs relative load.
+#define SMP_SELF_READ(member) \
+    ({ \
+        typeof(((cpu_t*)0)->member) value; \
+        asm volatile("mov %%gs:%c1, %0" : "=r"(value) : "i"(offsetof(cpu_t, member))); \
+        value; \
+    })
+
+// Writes a member of the running cpus cpu_t with a single gs relative store.
+#define SMP_SELF_WRITE(member, value) \
+    ({ \
+        typeof(((cpu_t*)0)->member) temp = (value); \
+        asm volatile("mov %0, %%gs:%c1" : : "r"(temp), "i"(offsetof(cpu_t, member)) : "memory"); \
+    })
+
 void smp_init(void);
 
 void smp_init_others(void);
@@ -44,18 +89,49 @@ bool smp_initialized(void);
 
 void smp_halt_others(void);
 
-ipi_t smp_recieve(cpu_t* cpu);
+static inline void smp_mask_set(smp_mask_t* mask, uint8_t id)
+{
+    mask->bits[id / 64] |= 1ULL << (id % 64);
+}
+
+static inline void smp_mask_clear(smp_mask_t* mask, uint8_t id)
+{
+    mask->bits[id / 64] &= ~(1ULL << (id % 64));
+}
+
+static inline bool smp_mask_test(const smp_mask_t* mask, uint8_t id)
+{
+    return (mask->bits[id / 64] & (1ULL << (id % 64))) != 0;
+}
+
+// Sets the bits of every existing cpu.
+void smp_mask_all(smp_mask_t* mask);
 
-void smp_send(cpu_t* cpu, ipi_t ipi);
+// Queues a caller owned call on cpu and interrupts it if needed, the call must stay valid until it has run.
+void smp_call_queue(cpu_t* cpu, smp_call_t* call);
 
-void smp_send_self(ipi_t ipi);
+// Runs all calls queued on cpu, called by the ipi handler and by cpus waiting for synchronous calls.
+void smp_call_process(cpu_t* cpu);
 
-void smp_send_others(ipi_t ipi);
+// Runs func on cpu and waits for it to return.
+void smp_call(cpu_t* cpu, smp_func_t func, void* private);
+
+// Runs func on cpu without waiting, private must stay valid until func has run.
+uint64_t smp_call_async(cpu_t* cpu, smp_func_t func, void* private);
+
+// Runs func on every cpu in mask and waits for all of them to return.
+void smp_call_mask(const smp_mask_t* mask, smp_func_t func, void* private);
+
+// Runs func on every cpu in mask without waiting, private must stay valid until func has run on every cpu.
+uint64_t smp_call_mask_async(const smp_mask_t* mask, smp_func_t func, void* private);
 
 uint8_t smp_cpu_amount(void);
 
 cpu_t* smp_cpu(uint8_t id);
 
+// Returns true if mask allows at least one existing cpu.
+bool smp_mask_valid(cpumask_t mask);
+
 cpu_t* smp_self_unsafe(void);
 
 cpu_t* smp_self_brute(void);
@@ -1,15 +1,83 @@
 #include "space.h"
 
+#include "cpuid.h"
 #include "log.h"
 #include "pmm.h"
+#include "regs.h"
+#include "smp.h"
+#include "sysfs.h"
 #include "utils.h"
 #include "vmm.h"
 
+// Invalidating more pages than this one by one is slower than flushing the entire tlb.
+#define SPACE_SHOOTDOWN_FLUSH_THRESHOLD 32
+
+typedef struct
+{
+    space_t* space;
+    void* virtAddr;
+    uint64_t pageAmount;
+} space_shootdown_t;
+
+static bool pcidDetected = false;
+static bool pcidEnabled = false;
+static bool invpcidEnabled = false;
+
+static atomic_uint64_t newSpaceId = ATOMIC_VAR_INIT(1);
+
+void space_cpu_init(void)
+{
+    // Decided once by the bootstrap cpu, every cpu is assumed to support the same features.
+    if (!pcidDetected)
+    {
+        pcidEnabled = cpuid_pcid_avail();
+        invpcidEnabled = pcidEnabled && cpuid_invpcid_avail();
+        pcidDetected = true;
+    }
+
+    if (pcidEnabled)
+    {
+        // The pcid field of cr3 must be zero when enabling, which it is as no user space has been loaded yet.
+        cr4_write(cr4_read() | CR4_PCID_ENABLE);
+    }
+}
+
+void space_pcid_cache_init(pcid_cache_t* cache)
+{
+    for (uint64_t i = 0; i < SPACE_PCID_SLOTS; i++)
+    {
+        cache->slots[i] = (pcid_slot_t){0};
+    }
+    cache->clock = 0;
+    cache->switches = 0;
+    cache->flushes = 0;
+}
+
+static void space_pcid_print(sysfs_text_t* text, void* private)
+{
+    sysfs_text_print(text, "mode %s\n", !pcidEnabled ? "disabled" : (invpcidEnabled ? "invpcid" : "pcid"));
+    sysfs_text_print(text, "cpu switches flushes\n");
+
+    uint8_t cpuAmount = smp_cpu_amount();
+    for (uint8_t id = 0; id < cpuAmount; id++)
+    {
+        pcid_cache_t* cache = &smp_cpu(id)->pcid;
+        sysfs_text_print(text, "%d %d %d\n", (uint64_t)id, cache->switches, cache->flushes);
+    }
+}
+
+void space_expose_stats(void)
+{
+    sysfs_expose_text("/stats", "pcid", space_pcid_print, NULL);
+}
+
 void space_init(space_t* space)
 {
     space->pml = pml_new();
     space->freeAddress = 0x400000;
     lock_init(&space->lock);
+    space->id = atomic_fetch_add(&newSpaceId, 1);
+    atomic_init(&space->tlbGeneration, 0);
 
     pml_t* kernelPml = vmm_kernel_pml();
     for (uint64_t i = PAGE_ENTRY_AMOUNT / 2; i < PAGE_ENTRY_AMOUNT; i++)
@@ -28,14 +96,150 @@ void space_cleanup(space_t* space)
     pml_free(space->pml);
 }
 
+static pcid_slot_t* space_pcid_slot(pcid_cache_t* cache, uint64_t spaceId)
+{
+    pcid_slot_t* victim = &cache->slots[0];
+    for (uint64_t i = 0; i < SPACE_PCID_SLOTS; i++)
+    {
+        pcid_slot_t* slot = &cache->slots[i];
+        if (slot->spaceId == spaceId)
+        {
+            return slot;
+        }
+
+        if (slot->lastUse < victim->lastUse)
+        {
+            victim = slot;
+        }
+    }
+
+    return victim;
+}
+
+static void space_load_pcid(cpu_t* self, space_t* space)
+{
+    pcid_cache_t* cache = &self->pcid;
+    pcid_slot_t* slot = space_pcid_slot(cache, space->id);
+    uint64_t pcid = (slot - cache->slots) + 1;
+    uint64_t cr3 = (uint64_t)VMM_HIGHER_TO_LOWER(space->pml) | pcid;
+
+    slot->lastUse = ++cache->clock;
+
+    // The generation is deliberately not refreshed here, a shootdown might still be pending behind a higher priority
+    // interrupt that switches away first.
+    if (cr3_read() == cr3)
+    {
+        return;
+    }
+
+    cache->switches++;
+
+    // Must be read after cpu->space is published, any later shootdown will interrupt this cpu instead.
+    uint64_t generation = atomic_load(&space->tlbGeneration);
+    if (slot->spaceId == space->id && slot->generation == generation)
+    {
+        cr3_write(cr3 | CR3_NO_FLUSH);
+        return;
+    }
+
+    // Either the slot held another space or translations cached for this one may be stale.
+    slot->spaceId = space->id;
+    slot->generation = generation;
+    cache->flushes++;
+
+    if (invpcidEnabled)
+    {
+        invpcid(INVPCID_SINGLE_CONTEXT, pcid, 0);
+        cr3_write(cr3 | CR3_NO_FLUSH);
+    }
+    else
+    {
+        cr3_write(cr3);
+    }
+}
+
 void space_load(space_t* space)
 {
+    // Published before the switch so that a shootdown either sees this cpu on the new space or its page table changes
+    // are already visible when the new page table is loaded.
+    cpu_t* self = smp_self_unsafe();
+    atomic_store(&self->space, space);
+
     if (space == NULL)
     {
-        pml_load(vmm_kernel_pml());
+        // Kernel mappings are global, so loading the kernel space never needs to flush anything.
+        if (pcidEnabled)
+        {
+            uint64_t cr3 = (uint64_t)VMM_HIGHER_TO_LOWER(vmm_kernel_pml());
+            if (cr3_read() != cr3)
+            {
+                cr3_write(cr3 | CR3_NO_FLUSH);
+            }
+        }
+        else
+        {
+            pml_load(vmm_kernel_pml());
+        }
+    }
+    else if (pcidEnabled)
+    {
+        space_load_pcid(self, space);
     }
     else
     {
         pml_load(space->pml);
     }
 }
+
+static void space_shootdown_call(void* private)
+{
+    const space_shootdown_t* shootdown = private;
+
+    // A cpu that switched away since the call was sent has already flushed its translations of the space.
+    if (atomic_load(&smp_self_unsafe()->space) != shootdown->space)
+    {
+        return;
+    }
+
+    if (shootdown->pageAmount > SPACE_SHOOTDOWN_FLUSH_THRESHOLD)
+    {
+        cr3_write(cr3_read());
+        return;
+    }
+
+    for (uint64_t i = 0; i < shootdown->pageAmount; i++)
+    {
+        PAGE_INVALIDATE((uintptr_t)shootdown->virtAddr + i * PAGE_SIZE);
+    }
+}
+
+void space_tlb_shootdown(space_t* space, void* virtAddr, uint64_t pageAmount)
+{
+    space_shootdown_t shootdown = {.space = space, .virtAddr = virtAddr, .pageAmount = pageAmount};
+
+    // Cpus that switched away keep the old translations tagged by pcid, this forces a flush when they switch back.
+    atomic_fetch_add(&space->tlbGeneration, 1);
+
+    // Pairs with the store in space_load().
+    atomic_thread_fence(memory_order_seq_cst);
+
+    cpu_t* self = smp_self();
+    smp_mask_t mask = {0};
+    bool empty = true;
+    uint8_t cpuAmount = smp_cpu_amount();
+    for (uint8_t id = 0; id < cpuAmount; id++)
+    {
+        if (id != self->id && atomic_load(&smp_cpu(id)->space) == space)
+        {
+            smp_mask_set(&mask, id);
+            empty = false;
+        }
+    }
+
+    // Single threaded processes never need to interrupt anyone.
+    if (!empty)
+    {
+        smp_call_mask(&mask, space_shootdown_call, &shootdown);
+    }
+    smp_put();
+}
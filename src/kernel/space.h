@@ -4,15 +4,47 @@
 #include "lock.h"
 #include "pml.h"
 
+// Amount of address spaces each cpu keeps tagged translations for, slot n uses pcid n + 1 and pcid 0 is the kernel.
+#define SPACE_PCID_SLOTS 8
+
 typedef struct
 {
     pml_t* pml;
     uintptr_t freeAddress;
     lock_t lock;
+    uint64_t id;                    // Never reused, so a pcid slot can not mistake a new space for a freed one
+    atomic_uint64_t tlbGeneration; // Incremented by every shootdown
 } space_t;
 
+typedef struct
+{
+    uint64_t spaceId; // 0 if unused
+    uint64_t generation;
+    uint64_t lastUse;
+} pcid_slot_t;
+
+typedef struct
+{
+    pcid_slot_t slots[SPACE_PCID_SLOTS];
+    uint64_t clock;
+    uint64_t switches;
+    uint64_t flushes;
+} pcid_cache_t;
+
+// Enables pcids on the calling cpu if supported, called by every cpu before it loads any user space.
+void space_cpu_init(void);
+
+void space_pcid_cache_init(pcid_cache_t* cache);
+
+void space_expose_stats(void);
+
 void space_init(space_t* space);
 
 void space_cleanup(space_t* space);
 
 void space_load(space_t* space);
+
+// Invalidates the range on every other cpu that currently has the space loaded, the caller must already have changed
+// the page table and invalidated the range on its own cpu. Waits for those cpus, so it must not be called with the
+// space lock or any other lock that a cpu running the space could spin on with interrupts disabled.
+void space_tlb_shootdown(space_t* space, void* virtAddr, uint64_t pageAmount);
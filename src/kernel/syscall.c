@@ -6,10 +6,13 @@
 
 #include "config.h"
 #include "defs.h"
+#include "futex.h"
 #include "gdt.h"
 #include "loader.h"
 #include "pipe.h"
+#include "regs.h"
 #include "sched.h"
+#include "smp.h"
 #include "thread.h"
 #include "time.h"
 #include "vfs.h"
@@ -66,7 +69,7 @@ NORETURN void syscall_thread_exit(void)
     sched_thread_exit();
 }
 
-pid_t syscall_spawn(const char** argv, const spawn_fd_t* fds)
+pid_t syscall_spawn(const char** argv, const spawn_fd_t* fds, const spawn_attr_t* attr)
 {
     uint64_t argc = 0;
     while (1)
@@ -113,11 +116,27 @@ pid_t syscall_spawn(const char** argv, const spawn_fd_t* fds)
         }
     }
 
-    thread_t* thread = loader_spawn(argv, PRIORITY_MIN);
+    cpumask_t affinity = sched_thread()->affinity;
+    if (attr != NULL)
+    {
+        if (!verify_buffer(attr, sizeof(spawn_attr_t)))
+        {
+            return ERROR(EFAULT);
+        }
+        else if (!smp_mask_valid(attr->affinity))
+        {
+            return ERROR(EINVAL);
+        }
+
+        affinity = attr->affinity;
+    }
+
+    thread_t* thread = loader_spawn(argv, sched_thread()->basePriority);
     if (thread == NULL)
     {
         return ERR;
     }
+    thread->affinity = affinity;
 
     vfs_context_t* parentVfsContext = &sched_process()->vfsContext;
     vfs_context_t* childVfsContext = &thread->process->vfsContext;
@@ -439,13 +458,14 @@ tid_t syscall_split(void* entry, uint64_t argc, ...)
 
     va_list args;
     va_start(args, argc);
-    thread_t* thread = loader_split(sched_thread(), entry, PRIORITY_MIN, argc, args);
+    thread_t* thread = loader_split(sched_thread(), entry, sched_thread()->basePriority, argc, args);
     va_end(args);
 
     if (thread == NULL)
     {
         return ERR;
     }
+    thread->affinity = sched_thread()->affinity;
 
     sched_push(thread);
     return thread->id;
@@ -457,6 +477,53 @@ uint64_t syscall_yield(void)
     return 0;
 }
 
+uint64_t syscall_futex_wait(uint64_t* address, uint64_t expected, nsec_t timeout)
+{
+    if ((uintptr_t)address % sizeof(uint64_t) != 0 || !verify_pointer(address, sizeof(uint64_t)))
+    {
+        return ERROR(EFAULT);
+    }
+
+    return futex_wait(address, expected, timeout);
+}
+
+uint64_t syscall_futex_wake(uint64_t* address, uint64_t amount)
+{
+    if ((uintptr_t)address % sizeof(uint64_t) != 0 || !verify_pointer(address, sizeof(uint64_t)))
+    {
+        return ERROR(EFAULT);
+    }
+
+    return futex_wake(address, amount);
+}
+
+uint64_t syscall_nice(int64_t nice)
+{
+    return sched_nice(nice);
+}
+
+uint64_t syscall_affinity(cpumask_t mask)
+{
+    return sched_affinity(mask);
+}
+
+uint64_t syscall_deadline(nsec_t runtime, nsec_t period, nsec_t deadline)
+{
+    return sched_deadline(runtime, period, deadline);
+}
+
+uint64_t syscall_settls(void* base)
+{
+    // A non canonical base would fault when loaded.
+    if (!verify_pointer(base, sizeof(uint64_t)))
+    {
+        return ERROR(EFAULT);
+    }
+
+    thread_tls_set(base);
+    return 0;
+}
+
 ///////////////////////////////////////////////////////
 
 void syscall_handler_end(void)
@@ -466,7 +533,7 @@ void syscall_handler_end(void)
         sched_thread_exit();
     }
 
-    sched_invoke();
+    sched_invoke_if_needed();
 }
 
 void* syscallTable[] = {
@@ -496,4 +563,20 @@ void* syscallTable[] = {
     syscall_pipe,
     syscall_split,
     syscall_yield,
+    syscall_futex_wait,
+    syscall_futex_wake,
+    syscall_nice,
+    syscall_affinity,
+    syscall_deadline,
+    syscall_settls,
 };
+
+void syscall_init(void)
+{
+    msr_write(MSR_EFER, msr_read(MSR_EFER) | EFER_SYSCALL_ENABLE);
+
+    // Sysret loads cs from the base plus 16 and ss from the base plus 8.
+    msr_write(MSR_STAR, ((uint64_t)(GDT_USER_DATA - 8) << 48) | ((uint64_t)GDT_KERNEL_CODE << 32));
+    msr_write(MSR_LSTAR, (uint64_t)syscall_entry);
+    msr_write(MSR_SYSCALL_FLAG_MASK, RFLAGS_INTERRUPT_ENABLE | RFLAGS_DIRECTION | RFLAGS_TRAP);
+}
@@ -1,9 +1,9 @@
 #pragma once
 
-#define SYSCALL_VECTOR 0x80
-
 extern void* syscallTable[];
 
-extern void syscall_handler(void);
+extern void syscall_entry(void);
+
+void syscall_init(void);
 
-void syscall_handler_end(void);
\ No newline at end of file
+void syscall_handler_end(void);
@@ -1,43 +1,62 @@
 %include "kernel/syscalls.inc"
 
+; Offsets into cpu_t, see smp.h.
+%define CPU_KERNEL_RSP 8
+%define CPU_USER_RSP 16
+
 extern syscall_handler_end
 extern syscallTable
 
 section .text
 
-global syscall_handler
-syscall_handler:
-    cmp rax, SYS_TOTAL_AMOUNT
-    jae .not_available
+; Entered through the syscall instruction with interrupts masked, rcx holds the user rip and r11 the user rflags.
+; The fourth argument is passed in r10 as rcx is clobbered by syscall.
+global syscall_entry
+syscall_entry:
+    swapgs
+    mov [gs:CPU_USER_RSP], rsp
+    mov rsp, [gs:CPU_KERNEL_RSP]
+    push qword [gs:CPU_USER_RSP]
+    sti
 
+    push rcx
+    push r11
     push rdi
     push rsi
     push rdx
-    push rcx
     push r8
     push r9
     push r10
-    push r11
     push rbp
 
+    cmp rax, SYS_TOTAL_AMOUNT
+    jae .not_available
+
     mov rbp, 0
+    mov rcx, r10
 
     call [syscallTable + rax * 8]
     push rax
+    sub rsp, 8
     call syscall_handler_end
+    add rsp, 8
     pop rax
 
+.return:
     pop rbp
-    pop r11
     pop r10
     pop r9
     pop r8
-    pop rcx
     pop rdx
     pop rsi
     pop rdi
+    pop r11
+    pop rcx
 
-    iretq
+    cli
+    swapgs
+    pop rsp
+    o64 sysret
 .not_available:
     mov rax, -1
-    iretq
+    jmp .return
@@ -1,8 +1,9 @@
 #include "sysfs.h"
 
-#include "lock.h"
 #include "log.h"
+#include "mutex.h"
 #include "sched.h"
+#include "slab.h"
 #include "sys/list.h"
 #include "vfs.h"
 
@@ -10,19 +11,24 @@
 #include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/math.h>
 
 static node_t root;
-static lock_t lock;
+
+static slab_cache_t nodeCache = SLAB_CACHE_INIT(node_t, NULL);
+static slab_cache_t resourceCache = SLAB_CACHE_INIT(resource_t, NULL);
+// Sleeping lock, exposing a resource allocates while holding it.
+static mutex_t lock;
 
 static void resource_free(resource_t* resource)
 {
     if (resource->delete != NULL)
     {
-        resource->delete (resource); // Why is clang-format doing this?
+        resource->delete (resource->private); // Why is clang-format doing this?
     }
 
     node_remove(&resource->node);
-    free(resource);
+    slab_free(&resourceCache, resource);
 }
 
 #define SYSFS_OPERATION(name, file, ...) \
@@ -122,7 +128,7 @@ static file_ops_t fileOps = {
 
 static file_t* sysfs_open(volume_t* volume, const char* path)
 {
-    LOCK_GUARD(&lock);
+    MUTEX_GUARD(&lock);
 
     node_t* node = node_traverse(&root, path, VFS_NAME_SEPARATOR);
     if (node == NULL)
@@ -152,7 +158,7 @@ static file_t* sysfs_open(volume_t* volume, const char* path)
 
 static uint64_t sysfs_stat(volume_t* volume, const char* path, stat_t* stat)
 {
-    LOCK_GUARD(&lock);
+    MUTEX_GUARD(&lock);
 
     node_t* node = node_traverse(&root, path, VFS_NAME_SEPARATOR);
     if (node == NULL)
@@ -168,7 +174,7 @@ static uint64_t sysfs_stat(volume_t* volume, const char* path, stat_t* stat)
 
 static uint64_t sysfs_listdir(volume_t* volume, const char* path, dir_entry_t* entries, uint64_t amount)
 {
-    LOCK_GUARD(&lock);
+    MUTEX_GUARD(&lock);
 
     node_t* node = node_traverse(&root, path, VFS_NAME_SEPARATOR);
     if (node == NULL)
@@ -215,7 +221,7 @@ static fs_t sysfs = {
 void sysfs_init(void)
 {
     node_init(&root, "root", SYSFS_SYSTEM);
-    lock_init(&lock);
+    mutex_init(&lock);
 
     LOG_ASSERT(vfs_mount("sys", &sysfs) != ERR, "mount fail");
 
@@ -225,7 +231,7 @@ void sysfs_init(void)
 resource_t* sysfs_expose(const char* path, const char* filename, const file_ops_t* ops, void* private, resource_open_t open,
     resource_delete_t delete)
 {
-    LOCK_GUARD(&lock);
+    MUTEX_GUARD(&lock);
 
     node_t* parent = &root;
     const char* name = name_first(path);
@@ -234,7 +240,7 @@ resource_t* sysfs_expose(const char* path, const char* filename, const file_ops_
         node_t* child = node_find(parent, name, VFS_NAME_SEPARATOR);
         if (child == NULL)
         {
-            child = malloc(sizeof(node_t));
+            child = slab_alloc(&nodeCache);
             char nameCopy[MAX_NAME];
             name_copy(nameCopy, name);
             node_init(child, nameCopy, SYSFS_SYSTEM);
@@ -245,7 +251,7 @@ resource_t* sysfs_expose(const char* path, const char* filename, const file_ops_
         name = name_next(name);
     }
 
-    resource_t* resource = malloc(sizeof(resource_t));
+    resource_t* resource = slab_alloc(&resourceCache);
     node_init(&resource->node, filename, SYSFS_RESOURCE);
     resource->ops = ops;
     resource->private = private;
@@ -260,9 +266,9 @@ resource_t* sysfs_expose(const char* path, const char* filename, const file_ops_
 
 void sysfs_hide(resource_t* resource)
 {
-    lock_acquire(&lock);
+    mutex_acquire(&lock);
     list_remove(resource);
-    lock_release(&lock);
+    mutex_release(&lock);
 
     atomic_store(&resource->hidden, true);
     if (atomic_fetch_sub(&resource->ref, 1) <= 1)
@@ -270,3 +276,112 @@ void sysfs_hide(resource_t* resource)
         resource_free(resource);
     }
 }
+
+typedef struct
+{
+    sysfs_text_print_t print;
+    void* private;
+} sysfs_text_resource_t;
+
+static void sysfs_text_append(sysfs_text_t* text, const char* string, uint64_t length)
+{
+    if (text->length + length + 1 > text->capacity)
+    {
+        text->capacity = MAX(text->capacity * 2, text->length + length + 1);
+        text->data = realloc(text->data, text->capacity);
+    }
+
+    memcpy(text->data + text->length, string, length);
+    text->length += length;
+    text->data[text->length] = '\0';
+}
+
+void sysfs_text_print(sysfs_text_t* text, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+
+    const char* ptr = format;
+    while (*ptr != '\0')
+    {
+        if (ptr[0] == '%' && ptr[1] == 'd')
+        {
+            char number[32];
+            ulltoa(va_arg(args, uint64_t), number, 10);
+            sysfs_text_append(text, number, strlen(number));
+            ptr += 2;
+        }
+        else if (ptr[0] == '%' && ptr[1] == 'x')
+        {
+            char number[32];
+            ulltoa(va_arg(args, uint64_t), number, 16);
+            sysfs_text_append(text, number, strlen(number));
+            ptr += 2;
+        }
+        else if (ptr[0] == '%' && ptr[1] == 's')
+        {
+            const char* string = va_arg(args, const char*);
+            sysfs_text_append(text, string, strlen(string));
+            ptr += 2;
+        }
+        else
+        {
+            sysfs_text_append(text, ptr, 1);
+            ptr++;
+        }
+    }
+
+    va_end(args);
+}
+
+static uint64_t sysfs_text_read(file_t* file, void* buffer, uint64_t count)
+{
+    sysfs_text_t* text = file->private;
+
+    count = (file->pos <= text->length) ? MIN(count, text->length - file->pos) : 0;
+    memcpy(buffer, text->data + file->pos, count);
+    file->pos += count;
+
+    return count;
+}
+
+static void sysfs_text_cleanup(file_t* file)
+{
+    sysfs_text_t* text = file->private;
+    free(text->data);
+    free(text);
+}
+
+static file_ops_t textOps = {
+    .read = sysfs_text_read,
+    .cleanup = sysfs_text_cleanup,
+};
+
+static uint64_t sysfs_text_open(resource_t* resource, file_t* file)
+{
+    sysfs_text_resource_t* textResource = resource->private;
+
+    sysfs_text_t* text = malloc(sizeof(sysfs_text_t));
+    text->data = NULL;
+    text->length = 0;
+    text->capacity = 0;
+    sysfs_text_append(text, "", 0);
+    textResource->print(text, textResource->private);
+
+    file->private = text;
+    return 0;
+}
+
+static void sysfs_text_delete(void* private)
+{
+    free(private);
+}
+
+resource_t* sysfs_expose_text(const char* path, const char* filename, sysfs_text_print_t print, void* private)
+{
+    sysfs_text_resource_t* textResource = malloc(sizeof(sysfs_text_resource_t));
+    textResource->print = print;
+    textResource->private = private;
+
+    return sysfs_expose(path, filename, &textOps, textResource, sysfs_text_open, sysfs_text_delete);
+}
@@ -23,9 +23,24 @@ typedef struct resource
     atomic_bool hidden;
 } resource_t;
 
+typedef struct
+{
+    char* data;
+    uint64_t length;
+    uint64_t capacity;
+} sysfs_text_t;
+
+typedef void (*sysfs_text_print_t)(sysfs_text_t*, void*);
+
 void sysfs_init(void);
 
 resource_t* sysfs_expose(const char* path, const char* filename, const file_ops_t* ops, void* private, resource_open_t open,
     resource_delete_t delete);
 
 void sysfs_hide(resource_t* resource);
+
+// Appends formatted text, supports %d and %x for unsigned integers and %s for strings.
+void sysfs_text_print(sysfs_text_t* text, const char* format, ...);
+
+// Exposes a read only resource whose content is generated by print each time the resource is opened.
+resource_t* sysfs_expose_text(const char* path, const char* filename, sysfs_text_print_t print, void* private);
@@ -3,6 +3,7 @@
 #include "defs.h"
 #include "gdt.h"
 #include "regs.h"
+#include "slab.h"
 #include "smp.h"
 #include "time.h"
 #include "vfs.h"
@@ -13,6 +14,9 @@
 
 static _Atomic pid_t newPid = ATOMIC_VAR_INIT(0);
 
+static slab_cache_t processCache = SLAB_CACHE_INIT(process_t, NULL);
+static slab_cache_t threadCache = SLAB_CACHE_INIT(thread_t, NULL);
+
 static char** process_allocate_argv(const char** src)
 {
     uint64_t argc = 0;
@@ -61,11 +65,11 @@ static char** process_allocate_argv(const char** src)
 
 static process_t* process_new(const char** argv)
 {
-    process_t* process = malloc(sizeof(process_t));
+    process_t* process = slab_alloc(&processCache);
     process->argv = process_allocate_argv(argv);
     if (process->argv == NULL)
     {
-        free(process);
+        slab_free(&processCache, process);
         return NULL;
     }
     process->killed = false;
@@ -83,14 +87,18 @@ static void process_free(process_t* process)
     vfs_context_cleanup(&process->vfsContext);
     space_cleanup(&process->space);
     free(process->argv);
-    free(process);
+    slab_free(&processCache, process);
 }
 
+static list_t registry = {.head = {.prev = &registry.head, .next = &registry.head}};
+static uint64_t registryAmount;
+static lock_t registryLock;
+
 static thread_t* process_thread_new(process_t* process, void* entry, priority_t priority)
 {
     atomic_fetch_add(&process->ref, 1);
 
-    thread_t* thread = malloc(sizeof(thread_t));
+    thread_t* thread = slab_alloc(&threadCache);
     list_entry_init(&thread->entry);
     thread->process = process;
     thread->id = atomic_fetch_add(&thread->process->newTid, 1);
@@ -100,8 +108,23 @@ static thread_t* process_thread_new(process_t* process, void* entry, priority_t
     thread->block.deadline = 0;
     thread->block.result = BLOCK_NORM;
     thread->block.blocker = NULL;
+    thread->block.generation = 0;
+    thread->block.exclusive = false;
+    wheel_entry_init(&thread->block.timer);
     thread->error = 0;
     thread->priority = MIN(priority, PRIORITY_MAX);
+    thread->basePriority = thread->priority;
+    thread->sliceUsed = 0;
+    thread->history.count = 0;
+    thread->lastCpu = THREAD_CPU_NONE;
+    thread->affinity = CPU_MASK_ALL;
+    thread->migrations = 0;
+    thread->balanceTime = 0;
+    thread->boostEpoch = 0;
+    thread->mutexDepth = 0;
+    thread->stats = (thread_stats_t){0};
+    thread->deadline = (thread_deadline_t){0};
+    thread->tlsBase = NULL;
     simd_context_init(&thread->simdContext);
     memset(&thread->kernelStack, 0, CONFIG_KERNEL_STACK);
 
@@ -112,6 +135,11 @@ static thread_t* process_thread_new(process_t* process, void* entry, priority_t
     thread->trapFrame.ss = GDT_KERNEL_DATA;
     thread->trapFrame.rflags = RFLAGS_INTERRUPT_ENABLE | RFLAGS_ALWAYS_SET;
 
+    list_entry_init(&thread->registryEntry);
+    LOCK_GUARD(&registryLock);
+    list_push(&registry, &thread->registryEntry);
+    registryAmount++;
+
     return thread;
 }
 
@@ -134,13 +162,23 @@ thread_t* thread_new(const char** argv, void* entry, priority_t priority)
 
 void thread_free(thread_t* thread)
 {
+    if (thread_is_deadline(thread))
+    {
+        atomic_fetch_sub(&smp_cpu(thread->deadline.cpu)->sched.deadlineUtil, thread->deadline.util);
+    }
+
+    lock_acquire(&registryLock);
+    list_remove(&thread->registryEntry);
+    registryAmount--;
+    lock_release(&registryLock);
+
     if (atomic_fetch_sub(&thread->process->ref, 1) <= 1)
     {
         process_free(thread->process);
     }
 
     simd_context_cleanup(&thread->simdContext);
-    free(thread);
+    slab_free(&threadCache, thread);
 }
 
 thread_t* thread_split(thread_t* thread, void* entry, priority_t priority)
@@ -154,6 +192,36 @@ void thread_save(thread_t* thread, const trap_frame_t* trapFrame)
     thread->trapFrame = *trapFrame;
 }
 
+static void thread_stats_dispatched(thread_t* thread, nsec_t uptime)
+{
+    thread_stats_t* stats = &thread->stats;
+    if (stats->readyTime == 0)
+    {
+        return;
+    }
+
+    nsec_t wait = uptime - stats->readyTime;
+    stats->readyTime = 0;
+
+    uint64_t bucket = 0;
+    for (nsec_t bound = SEC / 100000; bucket < THREAD_WAIT_BUCKETS - 1 && wait >= bound; bound *= 10)
+    {
+        bucket++;
+    }
+    stats->waitHistogram[bucket]++;
+}
+
+// Writing the msr is serializing, so it is skipped for kernel threads, which never use fs, and when the cpu already
+// has the base loaded.
+static void thread_tls_load(cpu_t* self, void* base)
+{
+    if (base != NULL && base != self->tlsBase)
+    {
+        msr_write(MSR_FS_BASE, (uint64_t)base);
+        self->tlsBase = base;
+    }
+}
+
 void thread_load(thread_t* thread, trap_frame_t* trapFrame)
 {
     cpu_t* self = smp_self_unsafe();
@@ -169,16 +237,100 @@ void thread_load(thread_t* thread, trap_frame_t* trapFrame)
 
         space_load(NULL);
         tss_stack_load(&self->tss, NULL);
+        self->kernelRsp = 0;
     }
     else
     {
+        if (thread->lastCpu != THREAD_CPU_NONE && thread->lastCpu != self->id)
+        {
+            thread->migrations++;
+        }
+        thread->lastCpu = self->id;
         thread->timeStart = time_uptime();
-        thread->timeEnd = thread->timeStart + CONFIG_TIME_SLICE;
+        thread_stats_dispatched(thread, thread->timeStart);
+        if (thread_is_deadline(thread))
+        {
+            thread->timeEnd = thread->timeStart + thread->deadline.budget;
+        }
+        else
+        {
+            thread->timeEnd = thread->timeStart + priority_time_slice(thread->priority) - thread->sliceUsed;
+        }
 
         *trapFrame = thread->trapFrame;
 
         space_load(&thread->process->space);
         tss_stack_load(&self->tss, (void*)((uint64_t)thread->kernelStack + CONFIG_KERNEL_STACK));
+        self->kernelRsp = (uint64_t)thread->kernelStack + CONFIG_KERNEL_STACK;
         simd_context_load(&thread->simdContext);
+        thread_tls_load(self, thread->tlsBase);
+    }
+}
+
+void thread_tls_set(void* base)
+{
+    cpu_t* self = smp_self();
+    self->sched.runThread->tlsBase = base;
+    thread_tls_load(self, base);
+    smp_put();
+}
+
+void thread_set_priority(thread_t* thread, priority_t priority)
+{
+    thread->priority = priority;
+    thread->sliceUsed = 0;
+
+    priority_history_t* history = &thread->history;
+    history->changes[history->count++ % CONFIG_PRIORITY_HISTORY] = (priority_change_t){
+        .time = time_uptime(),
+        .priority = priority,
+    };
+}
+
+thread_snapshot_t* thread_snapshot(uint64_t* amount)
+{
+    // The heap must not be used with the registry lock held, so the array is allocated first and grown if threads were
+    // created in between.
+    uint64_t capacity = 0;
+    thread_snapshot_t* snapshots = NULL;
+    while (true)
+    {
+        lock_acquire(&registryLock);
+        if (registryAmount <= capacity)
+        {
+            break;
+        }
+        capacity = registryAmount + registryAmount / 4 + 1;
+        lock_release(&registryLock);
+
+        free(snapshots);
+        snapshots = malloc(capacity * sizeof(thread_snapshot_t));
+        if (snapshots == NULL)
+        {
+            *amount = 0;
+            return NULL;
+        }
+    }
+
+    uint64_t count = 0;
+    list_entry_t* entry;
+    LIST_FOR_EACH(entry, &registry)
+    {
+        const thread_t* thread = CONTAINER_OF(entry, thread_t, registryEntry);
+        snapshots[count++] = (thread_snapshot_t){
+            .pid = thread->process->id,
+            .id = thread->id,
+            .priority = thread->priority,
+            .basePriority = thread->basePriority,
+            .history = thread->history,
+            .lastCpu = thread->lastCpu,
+            .affinity = thread->affinity,
+            .migrations = thread->migrations,
+            .stats = thread->stats,
+        };
     }
+    lock_release(&registryLock);
+
+    *amount = count;
+    return snapshots;
 }
@@ -12,13 +12,22 @@
 #include "space.h"
 #include "trap.h"
 #include "vfs_context.h"
+#include "wheel.h"
 
 typedef uint8_t priority_t;
 
-#define PRIORITY_LEVELS 3
+#define PRIORITY_LEVELS 16
 #define PRIORITY_MIN 0
 #define PRIORITY_MAX (PRIORITY_LEVELS - 1)
 
+// Base priority of user threads with a nice value of 0, see nice().
+#define PRIORITY_USER (PRIORITY_MAX - 4)
+
+// How many levels below its base priority a thread can be demoted.
+#define PRIORITY_DEMOTIONS 8
+
+#define THREAD_CPU_NONE UINT8_MAX
+
 typedef struct blocker blocker_t;
 
 typedef enum
@@ -43,11 +52,57 @@ typedef struct
     nsec_t deadline;
     block_result_t result;
     blocker_t* blocker;
+    uint64_t generation;
+    bool exclusive;
+    wheel_entry_t timer;
 } block_data_t;
 
+typedef struct
+{
+    nsec_t time;
+    priority_t priority;
+} priority_change_t;
+
+typedef struct
+{
+    priority_change_t changes[CONFIG_PRIORITY_HISTORY];
+    uint64_t count; // The latest change is at (count - 1) % CONFIG_PRIORITY_HISTORY, creation is not a change
+} priority_history_t;
+
+// Wait to run latencies are counted in buckets below 10us, 100us, 1ms, 10ms, 100ms and above.
+#define THREAD_WAIT_BUCKETS 6
+
+typedef struct
+{
+    nsec_t cpuTime;
+    nsec_t readyTime;           // When the thread was last queued to run, 0 while it is not waiting to run
+    uint64_t voluntarySwitches; // Blocked or yielded
+    uint64_t preemptions;       // Switched out while it still wanted to run
+    uint64_t waitHistogram[THREAD_WAIT_BUCKETS];
+} thread_stats_t;
+
+// Fixed point scale of thread_deadline_t::util, a utilization of THREAD_DEADLINE_SCALE is a whole cpu.
+#define THREAD_DEADLINE_SCALE (1 << 20)
+
+// A deadline thread is guaranteed runtime within deadline of the start of every period, it runs ahead of every normal
+// thread and deadline threads are ordered by absDeadline, see sched_deadline().
+typedef struct
+{
+    nsec_t runtime; // 0 if the thread is not a deadline thread
+    nsec_t period;
+    nsec_t deadline; // Relative to the start of each period
+    nsec_t periodStart;
+    nsec_t absDeadline;
+    nsec_t budget; // Runtime left in the current period
+    uint64_t util; // Reserved on cpu by admission control
+    uint8_t cpu;
+    cpumask_t affinity; // Affinity of the thread before it was pinned to cpu
+} thread_deadline_t;
+
 typedef struct
 {
     list_entry_t entry;
+    list_entry_t registryEntry;
     process_t* process;
     tid_t id;
     bool killed;
@@ -56,11 +111,47 @@ typedef struct
     block_data_t block;
     errno_t error;
     priority_t priority;
+    priority_t basePriority;
+    nsec_t sliceUsed;
+    priority_history_t history;
+    uint8_t lastCpu;
+    cpumask_t affinity;
+    uint64_t migrations;
+    nsec_t balanceTime;
+    uint64_t boostEpoch; // sched_context_t::boostEpoch of the cpu it was last queued on
+    uint64_t mutexDepth; // Mutexes held, a deadline thread is not throttled while it holds one
+    thread_stats_t stats;
+    thread_deadline_t deadline;
+    void* tlsBase; // Loaded into the fs base while the thread runs, NULL for kernel threads
     trap_frame_t trapFrame;
     simd_context_t simdContext;
     uint8_t kernelStack[CONFIG_KERNEL_STACK];
 } thread_t;
 
+// Higher levels get shorter slices so interactive threads run briefly but often while cpu bound threads sink to levels
+// with long slices.
+static inline nsec_t priority_time_slice(priority_t priority)
+{
+    return CONFIG_TIME_SLICE_MIN + (CONFIG_TIME_SLICE_MAX - CONFIG_TIME_SLICE_MIN) * (PRIORITY_MAX - priority) / PRIORITY_MAX;
+}
+
+// The lowest level a thread can be demoted to.
+static inline priority_t priority_floor(priority_t basePriority)
+{
+    return basePriority > PRIORITY_MIN + PRIORITY_DEMOTIONS ? basePriority - PRIORITY_DEMOTIONS : PRIORITY_MIN;
+}
+
+static inline bool thread_cpu_allowed(const thread_t* thread, uint8_t id)
+{
+    return id < 64 ? (thread->affinity & (1ULL << id)) != 0 : thread->affinity == CPU_MASK_ALL;
+}
+
+static inline bool thread_is_deadline(const thread_t* thread)
+{
+    return thread->deadline.runtime != 0;
+}
+
+// The priority is used as both the base and the current priority of the thread.
 thread_t* thread_new(const char** argv, void* entry, priority_t priority);
 
 void thread_free(thread_t* thread);
@@ -70,3 +161,28 @@ thread_t* thread_split(thread_t* thread, void* entry, priority_t priority);
 void thread_save(thread_t* thread, const trap_frame_t* trapFrame);
 
 void thread_load(thread_t* thread, trap_frame_t* trapFrame);
+
+// Sets the base of the thread local storage of the running thread.
+void thread_tls_set(void* base);
+
+// Moves the thread to a new level with a fresh slice and records the change in its history.
+void thread_set_priority(thread_t* thread, priority_t priority);
+
+// Copy of the fields of a thread that are shown in sysfs.
+typedef struct
+{
+    pid_t pid;
+    tid_t id;
+    priority_t priority;
+    priority_t basePriority;
+    priority_history_t history;
+    uint8_t lastCpu;
+    cpumask_t affinity;
+    uint64_t migrations;
+    thread_stats_t stats;
+} thread_snapshot_t;
+
+// Copies every thread that exists into an array allocated with malloc() and stores its length in amount, the registry
+// lock is only held while copying so the result can be formatted with interrupts enabled. Returns NULL with amount
+// set to 0 if there is no memory.
+thread_snapshot_t* thread_snapshot(uint64_t* amount);
@@ -32,5 +32,5 @@ void trampoline_cleanup(void)
     memcpy(TRAMPOLINE_PHYSICAL_START, backupBuffer, PAGE_SIZE);
     pmm_free(backupBuffer);
 
-    pml_unmap(vmm_kernel_pml(), TRAMPOLINE_PHYSICAL_START, 1);
+    pml_unmap(vmm_kernel_pml(), TRAMPOLINE_PHYSICAL_START, 1, NULL);
 }
@@ -20,12 +20,15 @@ void cli_push(void)
     uint64_t rflags = rflags_read();
     asm volatile("cli");
 
-    cpu_t* cpu = smp_self_unsafe();
-    if (cpu->cliAmount == 0)
+    uint64_t cliAmount = SMP_SELF_READ(cliAmount);
+    if (cliAmount == 0)
     {
-        cpu->prevFlags = rflags;
+        SMP_SELF_WRITE(prevFlags, rflags);
+#if CONFIG_IRQ_OFF_STATS
+        SMP_SELF_WRITE(cliStart, tsc_read());
+#endif
     }
-    cpu->cliAmount++;
+    SMP_SELF_WRITE(cliAmount, cliAmount + 1);
 }
 
 void cli_pop(void)
@@ -35,13 +38,21 @@ void cli_pop(void)
         return;
     }
 
-    cpu_t* cpu = smp_self_unsafe();
+    uint64_t cliAmount = SMP_SELF_READ(cliAmount);
 
-    LOG_ASSERT(cpu->cliAmount != 0, "cli amount underflow");
+    LOG_ASSERT(cliAmount != 0, "cli amount underflow");
 
-    cpu->cliAmount--;
-    if (cpu->cliAmount == 0 && cpu->prevFlags & RFLAGS_INTERRUPT_ENABLE && cpu->trapDepth == 0)
+    SMP_SELF_WRITE(cliAmount, cliAmount - 1);
+    if (cliAmount == 1 && SMP_SELF_READ(prevFlags) & RFLAGS_INTERRUPT_ENABLE && SMP_SELF_READ(trapDepth) == 0)
     {
+#if CONFIG_IRQ_OFF_STATS
+        // Bounds the latency of any interrupt that arrived in the meantime.
+        uint64_t cycles = tsc_read() - SMP_SELF_READ(cliStart);
+        if (cycles > SMP_SELF_READ(cliMax))
+        {
+            SMP_SELF_WRITE(cliMax, cycles);
+        }
+#endif
         asm volatile("sti");
     }
 }
@@ -61,23 +72,30 @@ static void exception_handler(const trap_frame_t* trapFrame)
 
 static void ipi_handler(trap_frame_t* trapFrame)
 {
-    cpu_t* cpu = smp_self_unsafe();
-    while (1)
-    {
-        ipi_t ipi = smp_recieve(cpu);
-        if (ipi == NULL)
-        {
-            break;
-        }
+    smp_call_process(smp_self_unsafe());
+    lapic_eoi();
+}
 
-        ipi(trapFrame);
+// Raised by the first simd instruction of a thread that has no simd state yet.
+static bool device_not_available_handler(void)
+{
+    thread_t* thread = SMP_SELF_READ(sched.runThread);
+    if (thread == NULL)
+    {
+        return false;
     }
 
-    lapic_eoi();
+    simd_context_fault(&thread->simdContext);
+    return true;
 }
 
 void trap_handler(trap_frame_t* trapFrame)
 {
+    if (trapFrame->vector == VECTOR_DEVICE_NOT_AVAILABLE && device_not_available_handler())
+    {
+        return;
+    }
+
     if (trapFrame->vector < VECTOR_IRQ_BASE)
     {
         exception_handler(trapFrame);
@@ -95,6 +113,12 @@ void trap_handler(trap_frame_t* trapFrame)
         ipi_handler(trapFrame);
     }
     else if (trapFrame->vector == VECTOR_SCHED_TIMER)
+    {
+        cpu->timerInterrupts++;
+        sched_schedule(trapFrame);
+        lapic_eoi();
+    }
+    else if (trapFrame->vector == VECTOR_SCHED_WAKE)
     {
         sched_schedule(trapFrame);
         lapic_eoi();
@@ -1,9 +1,11 @@
 #pragma once
 
+#define VECTOR_DEVICE_NOT_AVAILABLE 0x7
 #define VECTOR_IRQ_BASE 0x20
 #define VECTOR_IPI 0x90
 #define VECTOR_SCHED_TIMER 0xA0
 #define VECTOR_SCHED_INVOKE 0xB0
+#define VECTOR_SCHED_WAKE 0xC0
 
 #define VECTOR_AMOUNT 256
 
@@ -22,7 +22,13 @@ extern sched_schedule
 
 section .text
 
+; The gs base is swapped when the trap came from user space and when the trap frame returns to user space, the frame
+; may belong to another thread by the time it returns.
 vector_common:
+    test qword [rsp + 24], 3
+    jz .kernel_entry
+    swapgs
+.kernel_entry:
     push rax
     push rbx
     push rcx
@@ -60,6 +66,11 @@ vector_common:
     pop rbx
     pop rax
     add rsp, 16
+
+    test qword [rsp + 8], 3
+    jz .kernel_exit
+    swapgs
+.kernel_exit:
     iretq
 
 VECTOR_NO_ERR 0
@@ -1,7 +1,9 @@
 #include "vfs.h"
 
 #include "lock.h"
+#include "rwlock.h"
 #include "sched.h"
+#include "slab.h"
 #include "sys/list.h"
 #include "time.h"
 #include "vfs_context.h"
@@ -10,10 +12,13 @@
 #include <string.h>
 
 static list_t volumes;
-static lock_t volumesLock;
+static rwlock_t volumesLock;
 
 static blocker_t pollBlocker;
 
+static slab_cache_t fileCache = SLAB_CACHE_INIT(file_t, NULL);
+static slab_cache_t volumeCache = SLAB_CACHE_INIT(volume_t, NULL);
+
 // TODO: Improve file path parsing.
 
 static volume_t* volume_ref(volume_t* volume)
@@ -29,7 +34,7 @@ static void volume_deref(volume_t* volume)
 
 static volume_t* volume_get(const char* label)
 {
-    LOCK_GUARD(&volumesLock);
+    RWLOCK_READ_GUARD(&volumesLock);
 
     volume_t* volume;
     LIST_FOR_EACH(volume, &volumes)
@@ -45,7 +50,7 @@ static volume_t* volume_get(const char* label)
 
 file_t* file_new(volume_t* volume)
 {
-    file_t* file = malloc(sizeof(file_t)); // TODO: Slab allocator
+    file_t* file = slab_alloc(&fileCache);
     file->volume = volume;
     file->pos = 0;
     file->private = NULL;
@@ -74,7 +79,7 @@ void file_deref(file_t* file)
         {
             volume_deref(file->volume);
         }
-        free(file);
+        slab_free(&fileCache, file);
     }
 }
 
@@ -197,7 +202,7 @@ static uint64_t vfs_parse_path(char* out, const char* path)
 void vfs_init(void)
 {
     list_init(&volumes);
-    lock_init(&volumesLock);
+    rwlock_init(&volumesLock);
 
     blocker_init(&pollBlocker);
 }
@@ -208,7 +213,7 @@ uint64_t vfs_attach_simple(const char* label, const volume_ops_t* ops)
     {
         return ERROR(EINVAL);
     }
-    LOCK_GUARD(&volumesLock);
+    RWLOCK_WRITE_GUARD(&volumesLock);
 
     volume_t* volume;
     LIST_FOR_EACH(volume, &volumes)
@@ -219,7 +224,7 @@ uint64_t vfs_attach_simple(const char* label, const volume_ops_t* ops)
         }
     }
 
-    volume = malloc(sizeof(volume_t));
+    volume = slab_alloc(&volumeCache);
     list_entry_init(&volume->entry);
     strcpy(volume->label, label);
     volume->ops = ops;
@@ -236,7 +241,7 @@ uint64_t vfs_mount(const char* label, fs_t* fs)
 
 uint64_t vfs_unmount(const char* label)
 {
-    LOCK_GUARD(&volumesLock);
+    RWLOCK_WRITE_GUARD(&volumesLock);
 
     volume_t* volume;
     bool found = false;
@@ -270,7 +275,7 @@ uint64_t vfs_unmount(const char* label)
     }
 
     list_remove(volume);
-    free(volume);
+    slab_free(&volumeCache, volume);
     return 0;
 }
 
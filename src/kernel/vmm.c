@@ -11,6 +11,9 @@
 #include <string.h>
 #include <sys/math.h>
 
+// Pages unmapped per tlb shootdown, owned pages are freed after each batch once no cpu can access them anymore.
+#define VMM_UNMAP_BATCH 32
+
 static pml_t* kernelPml;
 
 static list_t blocks;
@@ -82,6 +85,7 @@ void vmm_init(efi_mem_map_t* memoryMap, boot_kernel_t* kernel, gop_buffer_t* gop
 void vmm_cpu_init(void)
 {
     cr4_write(cr4_read() | CR4_PAGE_GLOBAL_ENABLE);
+    space_cpu_init();
 }
 
 pml_t* vmm_kernel_pml(void)
@@ -182,14 +186,37 @@ uint64_t vmm_unmap(void* virtAddr, uint64_t length)
     vmm_align_region(&virtAddr, &length);
 
     space_t* space = &sched_process()->space;
-    LOCK_GUARD(&space->lock);
+    uint64_t pageAmount = SIZE_IN_PAGES(length);
 
-    if (!pml_mapped(space->pml, virtAddr, SIZE_IN_PAGES(length)))
+    lock_acquire(&space->lock);
+    if (!pml_mapped(space->pml, virtAddr, pageAmount))
     {
+        lock_release(&space->lock);
         return ERROR(EFAULT);
     }
 
-    pml_unmap(space->pml, virtAddr, SIZE_IN_PAGES(length));
+    // The shootdown waits for other cpus, one of them could be spinning on the space lock with interrupts disabled, so
+    // the lock is released for every shootdown.
+    for (uint64_t offset = 0; offset < pageAmount; offset += VMM_UNMAP_BATCH)
+    {
+        void* batchAddr = (void*)((uintptr_t)virtAddr + offset * PAGE_SIZE);
+        uint64_t batchAmount = MIN(VMM_UNMAP_BATCH, pageAmount - offset);
+
+        if (offset != 0)
+        {
+            lock_acquire(&space->lock);
+        }
+        void* ownedPages[VMM_UNMAP_BATCH];
+        uint64_t ownedAmount = pml_unmap(space->pml, batchAddr, batchAmount, ownedPages);
+        lock_release(&space->lock);
+
+        space_tlb_shootdown(space, batchAddr, batchAmount);
+
+        for (uint64_t i = 0; i < ownedAmount; i++)
+        {
+            pmm_free(ownedPages[i]);
+        }
+    }
 
     return 0;
 }
@@ -205,14 +232,19 @@ uint64_t vmm_protect(void* virtAddr, uint64_t length, prot_t prot)
     vmm_align_region(&virtAddr, &length);
 
     space_t* space = &sched_process()->space;
-    LOCK_GUARD(&space->lock);
 
+    lock_acquire(&space->lock);
     if (!pml_mapped(space->pml, virtAddr, SIZE_IN_PAGES(length)))
     {
+        lock_release(&space->lock);
         return ERROR(EFAULT);
     }
 
     pml_change_flags(space->pml, virtAddr, SIZE_IN_PAGES(length), flags);
+    lock_release(&space->lock);
+
+    // Sent without the space lock, see vmm_unmap().
+    space_tlb_shootdown(space, virtAddr, SIZE_IN_PAGES(length));
 
     return 0;
 }
@@ -226,3 +258,16 @@ bool vmm_mapped(const void* virtAddr, uint64_t length)
 
     return pml_mapped(space->pml, virtAddr, SIZE_IN_PAGES(length));
 }
+
+void* vmm_phys_addr(const void* virtAddr)
+{
+    space_t* space = &sched_process()->space;
+    LOCK_GUARD(&space->lock);
+
+    if (!pml_mapped(space->pml, (void*)ROUND_DOWN(virtAddr, PAGE_SIZE), 1))
+    {
+        return NULL;
+    }
+
+    return pml_phys_addr(space->pml, virtAddr);
+}
@@ -33,3 +33,6 @@ uint64_t vmm_unmap(void* virtAddr, uint64_t length);
 uint64_t vmm_protect(void* virtAddr, uint64_t length, prot_t prot);
 
 bool vmm_mapped(const void* virtAddr, uint64_t length);
+
+// Returns the physical address that virtAddr is mapped to in the current space, or NULL if it is not mapped.
+void* vmm_phys_addr(const void* virtAddr);
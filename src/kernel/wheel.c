@@ -0,0 +1,189 @@
+#include "wheel.h"
+
+#include <sys/math.h>
+
+static uint64_t wheel_ticks(nsec_t time)
+{
+    return time == NEVER ? UINT64_MAX : (time + WHEEL_TICK - 1) / WHEEL_TICK;
+}
+
+static void wheel_insert(wheel_t* wheel, wheel_entry_t* entry)
+{
+    uint64_t expires = wheel_ticks(entry->deadline);
+    if (expires <= wheel->current)
+    {
+        entry->level = WHEEL_LEVEL_EXPIRED;
+        list_push(&wheel->expired, entry);
+        return;
+    }
+
+    // Entries beyond the range of the wheel are placed in the last level and reinserted when they cascade down.
+    uint64_t delta = MIN(expires - wheel->current, WHEEL_MAX_DELTA);
+    expires = wheel->current + delta;
+
+    uint8_t level = 0;
+    while (delta >= (1ULL << ((level + 1) * WHEEL_SLOT_BITS)))
+    {
+        level++;
+    }
+
+    uint8_t slot = (expires >> (level * WHEEL_SLOT_BITS)) & WHEEL_SLOT_MASK;
+    entry->level = level;
+    entry->slot = slot;
+    list_push(&wheel->slots[level][slot], entry);
+    wheel->occupied[level] |= (1ULL << slot);
+    wheel->amount++;
+}
+
+static void wheel_unlink(wheel_t* wheel, wheel_entry_t* entry)
+{
+    list_remove(entry);
+    if (entry->level == WHEEL_LEVEL_EXPIRED)
+    {
+        return;
+    }
+
+    if (list_empty(&wheel->slots[entry->level][entry->slot]))
+    {
+        wheel->occupied[entry->level] &= ~(1ULL << entry->slot);
+    }
+    wheel->amount--;
+}
+
+static void wheel_cascade(wheel_t* wheel, uint8_t level, uint8_t slot)
+{
+    list_t* list = &wheel->slots[level][slot];
+    while (1)
+    {
+        wheel_entry_t* entry = list_first(list);
+        if (entry == NULL)
+        {
+            break;
+        }
+
+        wheel_unlink(wheel, entry);
+        wheel_insert(wheel, entry);
+    }
+}
+
+void wheel_init(wheel_t* wheel)
+{
+    for (uint64_t level = 0; level < WHEEL_LEVELS; level++)
+    {
+        for (uint64_t slot = 0; slot < WHEEL_SLOTS; slot++)
+        {
+            list_init(&wheel->slots[level][slot]);
+        }
+        wheel->occupied[level] = 0;
+    }
+    list_init(&wheel->expired);
+    wheel->current = 0;
+    wheel->amount = 0;
+    lock_init(&wheel->lock);
+}
+
+void wheel_entry_init(wheel_entry_t* entry)
+{
+    list_entry_init(&entry->entry);
+    entry->deadline = NEVER;
+    entry->wheel = NULL;
+    entry->level = 0;
+    entry->slot = 0;
+}
+
+void wheel_add(wheel_t* wheel, wheel_entry_t* entry, nsec_t deadline)
+{
+    entry->deadline = deadline;
+    entry->wheel = wheel;
+    wheel_insert(wheel, entry);
+}
+
+void wheel_remove(wheel_t* wheel, wheel_entry_t* entry)
+{
+    wheel_unlink(wheel, entry);
+    entry->wheel = NULL;
+}
+
+void wheel_advance(wheel_t* wheel, nsec_t uptime)
+{
+    uint64_t target = uptime / WHEEL_TICK;
+    while (wheel->current < target)
+    {
+        if (wheel->amount == 0)
+        {
+            wheel->current = target;
+            break;
+        }
+
+        // Nothing can reach the first level before the next cascade, so skip straight to it.
+        if (wheel->occupied[0] == 0)
+        {
+            uint64_t boundary = ROUND_DOWN(wheel->current, WHEEL_SLOTS) + WHEEL_SLOTS - 1;
+            if (boundary >= target)
+            {
+                wheel->current = target;
+                break;
+            }
+            wheel->current = boundary;
+        }
+
+        wheel->current++;
+
+        for (uint8_t level = 1; level < WHEEL_LEVELS; level++)
+        {
+            if ((wheel->current & ((1ULL << (level * WHEEL_SLOT_BITS)) - 1)) != 0)
+            {
+                break;
+            }
+
+            wheel_cascade(wheel, level, (wheel->current >> (level * WHEEL_SLOT_BITS)) & WHEEL_SLOT_MASK);
+        }
+
+        uint8_t slot = wheel->current & WHEEL_SLOT_MASK;
+        list_t* list = &wheel->slots[0][slot];
+        while (1)
+        {
+            wheel_entry_t* entry = list_first(list);
+            if (entry == NULL)
+            {
+                break;
+            }
+
+            wheel_unlink(wheel, entry);
+            entry->level = WHEEL_LEVEL_EXPIRED;
+            list_push(&wheel->expired, entry);
+        }
+    }
+}
+
+nsec_t wheel_next_deadline(wheel_t* wheel)
+{
+    if (!list_empty(&wheel->expired))
+    {
+        return 0;
+    }
+    else if (wheel->amount == 0)
+    {
+        return NEVER;
+    }
+
+    uint64_t next = UINT64_MAX;
+    for (uint8_t level = 0; level < WHEEL_LEVELS; level++)
+    {
+        uint64_t occupied = wheel->occupied[level];
+        if (occupied == 0)
+        {
+            continue;
+        }
+
+        // Rotate the slots so that the slot after the current position is bit zero.
+        uint8_t shift = level * WHEEL_SLOT_BITS;
+        uint8_t rotation = (((wheel->current >> shift) & WHEEL_SLOT_MASK) + 1) & WHEEL_SLOT_MASK;
+        uint64_t rotated = rotation == 0 ? occupied : (occupied >> rotation) | (occupied << (WHEEL_SLOTS - rotation));
+
+        uint64_t distance = __builtin_ctzll(rotated) + 1;
+        next = MIN(next, ((wheel->current >> shift) + distance) << shift);
+    }
+
+    return next * WHEEL_TICK;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "defs.h"
+#include "lock.h"
+
+#include <sys/list.h>
+#include <sys/proc.h>
+
+// Hierarchical timer wheel, each level covers WHEEL_SLOTS times the range of the level below it.
+
+#define WHEEL_TICK (SEC / CONFIG_SCHED_HZ)
+#define WHEEL_LEVELS 4
+#define WHEEL_SLOT_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_SLOT_BITS)
+#define WHEEL_SLOT_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_MAX_DELTA ((1ULL << (WHEEL_LEVELS * WHEEL_SLOT_BITS)) - 1)
+
+// Level used for entries that have expired but not yet been removed.
+#define WHEEL_LEVEL_EXPIRED WHEEL_LEVELS
+
+typedef struct wheel wheel_t;
+
+typedef struct
+{
+    list_entry_t entry;
+    nsec_t deadline;
+    wheel_t* wheel;
+    uint8_t level;
+    uint8_t slot;
+} wheel_entry_t;
+
+typedef struct wheel
+{
+    list_t slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    uint64_t occupied[WHEEL_LEVELS];
+    list_t expired;
+    uint64_t current;
+    uint64_t amount;
+    lock_t lock;
+} wheel_t;
+
+void wheel_init(wheel_t* wheel);
+
+void wheel_entry_init(wheel_entry_t* entry);
+
+// The wheel functions below do not acquire the lock of the wheel, the caller must hold it.
+
+void wheel_add(wheel_t* wheel, wheel_entry_t* entry, nsec_t deadline);
+
+void wheel_remove(wheel_t* wheel, wheel_entry_t* entry);
+
+// Moves every entry with a deadline before uptime to the expired list.
+void wheel_advance(wheel_t* wheel, nsec_t uptime);
+
+// Returns the earliest time at which wheel_advance could expire or cascade an entry, NEVER if the wheel is empty.
+nsec_t wheel_next_deadline(wheel_t* wheel);
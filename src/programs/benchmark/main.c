@@ -0,0 +1,670 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/dwm.h>
+#include <sys/heap.h>
+#include <sys/io.h>
+#include <sys/proc.h>
+#include <threads.h>
+
+#define NULL_SYSCALL_ITERATIONS 1000000
+
+#define PIPE_READERS_ITERATIONS 100000
+#define PIPE_READERS_MAX 16
+
+#define PIPE_PINGPONG_ITERATIONS 100000
+
+#define WAKEUP_ITERATIONS 1000
+
+#define LOCK_STRESS_ITERATIONS 20000
+#define LOCK_STRESS_MAX 16
+#define WAKEUP_INTERVAL (SEC / 1000)
+
+#define PAGE_CHURN_ITERATIONS 20000
+#define PAGE_CHURN_MAX 16
+
+#define THREAD_CHURN_ITERATIONS 10000
+
+#define OPEN_CLOSE_ITERATIONS 100000
+
+#define HEAP_CHURN_ITERATIONS 1000000
+#define HEAP_CHURN_SLOTS 1024
+
+#define HEAP_FRAGMENT_BLOCKS 4096
+
+#define HEAP_THREADS_ITERATIONS 200000
+#define HEAP_THREADS_SLOTS 256
+#define HEAP_THREADS_MAX 16
+
+#define EXIT_STORM_PROCESSES 64
+#define EXIT_STORM_DURATION (SEC / 2)
+
+#define FRAME_JITTER_LOAD_THREADS 16
+#define FRAME_JITTER_CLIENT_THREADS 4
+#define FRAME_JITTER_DURATION (SEC * 3)
+
+// Temporary becouse printf does not exist yet
+static void print(const char* str)
+{
+    write(STDOUT_FILENO, str, strlen(str));
+}
+
+static void printnum(uint64_t num)
+{
+    char buffer[32];
+    ulltoa(num, buffer, 10);
+    print(buffer);
+}
+
+static void print_file(const char* path)
+{
+    fd_t fd = open(path);
+    if (fd == ERR)
+    {
+        return;
+    }
+
+    char buffer[256];
+    uint64_t count;
+    while ((count = read(fd, buffer, sizeof(buffer))) != 0 && count != ERR)
+    {
+        write(STDOUT_FILENO, buffer, count);
+    }
+    close(fd);
+}
+
+static void print_result(const char* name, nsec_t total, uint64_t iterations)
+{
+    print(name);
+    print(": ");
+    printnum(total / iterations);
+    print(" ns per iteration, ");
+    printnum(total / (SEC / 1000));
+    print(" ms total\n");
+}
+
+// Round trip of the cheapest system call, measures the kernel entry and exit path.
+static void benchmark_null_syscall(void)
+{
+    nsec_t start = uptime();
+    for (uint64_t i = 0; i < NULL_SYSCALL_ITERATIONS; i++)
+    {
+        getpid();
+    }
+    nsec_t end = uptime();
+
+    print_result("null syscall", end - start, NULL_SYSCALL_ITERATIONS);
+}
+
+static int pipe_reader(void* arg)
+{
+    fd_t fd = (fd_t)(uint64_t)arg;
+
+    char byte;
+    while (read(fd, &byte, 1) == 1)
+    {
+    }
+
+    return 0;
+}
+
+// One writer feeding single bytes to readers all blocked on the same pipe, every write should only wake one reader.
+static void benchmark_pipe_readers(uint64_t readerAmount)
+{
+    pipefd_t pipefd;
+    if (pipe(&pipefd) == ERR)
+    {
+        print("pipe readers: pipe failed\n");
+        return;
+    }
+
+    thrd_t readers[PIPE_READERS_MAX];
+    for (uint64_t i = 0; i < readerAmount; i++)
+    {
+        thrd_create(&readers[i], pipe_reader, (void*)(uint64_t)pipefd.read);
+    }
+
+    nsec_t start = uptime();
+    char byte = 0;
+    for (uint64_t i = 0; i < PIPE_READERS_ITERATIONS; i++)
+    {
+        write(pipefd.write, &byte, 1);
+    }
+    close(pipefd.write);
+    for (uint64_t i = 0; i < readerAmount; i++)
+    {
+        thrd_join(readers[i], NULL);
+    }
+    nsec_t end = uptime();
+
+    close(pipefd.read);
+
+    char name[32] = "pipe readers x";
+    ulltoa(readerAmount, name + strlen(name), 10);
+    print_result(name, end - start, PIPE_READERS_ITERATIONS);
+}
+
+// Single byte round trips with a child process, every iteration is two switches between address spaces.
+static void benchmark_pipe_pingpong(void)
+{
+    pipefd_t request;
+    pipefd_t response;
+    if (pipe(&request) == ERR || pipe(&response) == ERR)
+    {
+        print("pipe pingpong: pipe failed\n");
+        return;
+    }
+
+    const char* argv[] = {"home:/usr/bin/pong", NULL};
+    spawn_fd_t fds[] = {{STDIN_FILENO, request.read}, {STDOUT_FILENO, response.write}, SPAWN_FD_END};
+    if (spawn(argv, fds, NULL) == ERR)
+    {
+        print("pipe pingpong: spawn failed\n");
+        close(request.read);
+        close(request.write);
+        close(response.read);
+        close(response.write);
+        return;
+    }
+    close(request.read);
+    close(response.write);
+
+    nsec_t start = uptime();
+    char byte = 0;
+    for (uint64_t i = 0; i < PIPE_PINGPONG_ITERATIONS; i++)
+    {
+        write(request.write, &byte, 1);
+        read(response.read, &byte, 1);
+    }
+    nsec_t end = uptime();
+
+    close(request.write);
+    close(response.read);
+
+    print_result("pipe pingpong", end - start, PIPE_PINGPONG_ITERATIONS);
+}
+
+typedef struct
+{
+    fd_t fd;
+    nsec_t total;
+    nsec_t max;
+} wakeup_latency_t;
+
+static int wakeup_waiter(void* arg)
+{
+    wakeup_latency_t* latency = arg;
+
+    nsec_t sent;
+    while (read(latency->fd, &sent, sizeof(sent)) == sizeof(sent))
+    {
+        nsec_t delta = uptime() - sent;
+        latency->total += delta;
+        latency->max = delta > latency->max ? delta : latency->max;
+    }
+
+    return 0;
+}
+
+// Time from a write until the blocked reader runs. The writer sleeps between writes so that the reader is back asleep
+// and its cpu has most likely gone idle, which measures how fast an idle cpu is woken.
+static void benchmark_wakeup_latency(void)
+{
+    pipefd_t pipefd;
+    if (pipe(&pipefd) == ERR)
+    {
+        print("wakeup latency: pipe failed\n");
+        return;
+    }
+
+    wakeup_latency_t latency = {.fd = pipefd.read, .total = 0, .max = 0};
+    thrd_t waiter;
+    thrd_create(&waiter, wakeup_waiter, &latency);
+
+    for (uint64_t i = 0; i < WAKEUP_ITERATIONS; i++)
+    {
+        sleep(WAKEUP_INTERVAL);
+        nsec_t sent = uptime();
+        write(pipefd.write, &sent, sizeof(sent));
+    }
+    close(pipefd.write);
+    thrd_join(waiter, NULL);
+    close(pipefd.read);
+
+    print_result("wakeup latency", latency.total, WAKEUP_ITERATIONS);
+    print("wakeup latency max: ");
+    printnum(latency.max);
+    print(" ns\n");
+}
+
+static int lock_stress_worker(void* arg)
+{
+    const char* path = arg;
+
+    stat_t info;
+    for (uint64_t i = 0; i < LOCK_STRESS_ITERATIONS; i++)
+    {
+        stat(path, &info);
+    }
+
+    return 0;
+}
+
+// Threads on as many cpus as possible resolving sysfs paths at once, every lookup takes the volume list lock and the
+// sysfs tree lock.
+static void benchmark_lock_stress(uint64_t threadAmount)
+{
+    thrd_t threads[LOCK_STRESS_MAX];
+
+    nsec_t start = uptime();
+    for (uint64_t i = 0; i < threadAmount; i++)
+    {
+        thrd_create(&threads[i], lock_stress_worker, "sys:/stats/timer");
+    }
+    for (uint64_t i = 0; i < threadAmount; i++)
+    {
+        thrd_join(threads[i], NULL);
+    }
+    nsec_t end = uptime();
+
+    char name[32] = "lock stress x";
+    ulltoa(threadAmount, name + strlen(name), 10);
+    print_result(name, end - start, LOCK_STRESS_ITERATIONS * threadAmount);
+}
+
+static int page_churn_worker(void* arg)
+{
+    // Spread over as many cpus as exist, a mask without an existing cpu is rejected and the thread runs anywhere.
+    uint64_t index = (uint64_t)arg;
+    affinity(1ULL << (index % 64));
+
+    for (uint64_t i = 0; i < PAGE_CHURN_ITERATIONS; i++)
+    {
+        pipefd_t pipefd;
+        if (pipe(&pipefd) == ERR)
+        {
+            break;
+        }
+        close(pipefd.read);
+        close(pipefd.write);
+    }
+
+    return 0;
+}
+
+// Every pipe buffer is one page, threads on separate cpus creating and closing pipes allocate and free pages in
+// parallel. sys:/stats/pagecache shows how few of those operations had to go to the shared allocator.
+static void benchmark_page_churn(uint64_t threadAmount)
+{
+    thrd_t threads[PAGE_CHURN_MAX];
+
+    nsec_t start = uptime();
+    for (uint64_t i = 0; i < threadAmount; i++)
+    {
+        thrd_create(&threads[i], page_churn_worker, (void*)i);
+    }
+    for (uint64_t i = 0; i < threadAmount; i++)
+    {
+        thrd_join(threads[i], NULL);
+    }
+    nsec_t end = uptime();
+
+    char name[32] = "page churn x";
+    ulltoa(threadAmount, name + strlen(name), 10);
+    print_result(name, end - start, PAGE_CHURN_ITERATIONS * threadAmount);
+}
+
+static int thread_churn_worker(void* arg)
+{
+    return 0;
+}
+
+// Every iteration allocates and frees a thread_t together with its kernel stack.
+static void benchmark_thread_churn(void)
+{
+    nsec_t start = uptime();
+    for (uint64_t i = 0; i < THREAD_CHURN_ITERATIONS; i++)
+    {
+        thrd_t thread;
+        if (thrd_create(&thread, thread_churn_worker, NULL) != thrd_success)
+        {
+            break;
+        }
+        thrd_join(thread, NULL);
+    }
+    nsec_t end = uptime();
+
+    print_result("thread churn", end - start, THREAD_CHURN_ITERATIONS);
+}
+
+// Every iteration allocates and frees a file_t.
+static void benchmark_open_close(void)
+{
+    nsec_t start = uptime();
+    for (uint64_t i = 0; i < OPEN_CLOSE_ITERATIONS; i++)
+    {
+        fd_t fd = open("home:/usr/bin/pong");
+        if (fd == ERR)
+        {
+            break;
+        }
+        close(fd);
+    }
+    nsec_t end = uptime();
+
+    print_result("open close", end - start, OPEN_CLOSE_ITERATIONS);
+}
+
+static uint64_t random_next(uint64_t* state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void print_heap_stats(void)
+{
+    heap_stats_t stats;
+    heap_stats(&stats);
+
+    print("heap: ");
+    printnum(stats.mapped / 1024);
+    print(" KiB mapped, ");
+    printnum(stats.used / 1024);
+    print(" KiB used, ");
+    printnum(stats.cached / 1024);
+    print(" KiB cached, ");
+    printnum(stats.free / 1024);
+    print(" KiB free in ");
+    printnum(stats.freeBlocks);
+    print(" blocks, largest free ");
+    printnum(stats.largestFree / 1024);
+    print(" KiB, released ");
+    printnum(stats.released);
+    print(" times\n");
+}
+
+// Frees and allocates random slots with mostly small sizes and the occasional large one, like a long running program.
+static void benchmark_heap_churn(void)
+{
+    static void* slots[HEAP_CHURN_SLOTS];
+    uint64_t state = 0x9E3779B97F4A7C15;
+
+    nsec_t start = uptime();
+    for (uint64_t i = 0; i < HEAP_CHURN_ITERATIONS; i++)
+    {
+        uint64_t slot = random_next(&state) % HEAP_CHURN_SLOTS;
+        free(slots[slot]);
+
+        uint64_t size = random_next(&state);
+        size = size % 16 != 0 ? size % 512 + 1 : size % (256 * 1024) + 1;
+        slots[slot] = malloc(size);
+    }
+    nsec_t end = uptime();
+
+    for (uint64_t i = 0; i < HEAP_CHURN_SLOTS; i++)
+    {
+        free(slots[i]);
+        slots[i] = NULL;
+    }
+
+    print_result("heap churn", end - start, HEAP_CHURN_ITERATIONS);
+    print_heap_stats();
+}
+
+// Frees every other small block and then asks for blocks twice as large, which only fit if the free blocks are
+// coalesced with their neighbours once the rest is freed.
+static void benchmark_heap_fragmentation(void)
+{
+    static void* blocks[HEAP_FRAGMENT_BLOCKS];
+
+    nsec_t start = uptime();
+    for (uint64_t i = 0; i < HEAP_FRAGMENT_BLOCKS; i++)
+    {
+        blocks[i] = malloc(64);
+    }
+    for (uint64_t i = 0; i < HEAP_FRAGMENT_BLOCKS; i += 2)
+    {
+        free(blocks[i]);
+        blocks[i] = NULL;
+    }
+    print_heap_stats();
+
+    for (uint64_t i = 1; i < HEAP_FRAGMENT_BLOCKS; i += 2)
+    {
+        free(blocks[i]);
+        blocks[i] = malloc(128);
+    }
+    nsec_t end = uptime();
+    print_heap_stats();
+
+    for (uint64_t i = 0; i < HEAP_FRAGMENT_BLOCKS; i++)
+    {
+        free(blocks[i]);
+        blocks[i] = NULL;
+    }
+
+    print_result("heap fragmentation", end - start, HEAP_FRAGMENT_BLOCKS + HEAP_FRAGMENT_BLOCKS / 2);
+    print_heap_stats();
+}
+
+static void* heapThreadsSlots[HEAP_THREADS_MAX][HEAP_THREADS_SLOTS];
+
+// Mostly replaces its own small blocks, but every eighth iteration replaces one of the next thread instead so that
+// blocks are regularly freed by a thread other than the one that allocated them.
+static int heap_threads_worker(void* arg)
+{
+    uint64_t index = (uint64_t)arg;
+    uint64_t state = 0x9E3779B97F4A7C15 + index;
+
+    for (uint64_t i = 0; i < HEAP_THREADS_ITERATIONS; i++)
+    {
+        uint64_t random = random_next(&state);
+        uint64_t owner = random % 8 != 0 ? index : (index + 1) % HEAP_THREADS_MAX;
+        void** slot = (void**)&heapThreadsSlots[owner][(random >> 3) % HEAP_THREADS_SLOTS];
+
+        void* ptr = malloc((random >> 16) % 512 + 1);
+        free(atomic_exchange((_Atomic(void*)*)slot, ptr));
+    }
+
+    return 0;
+}
+
+static void benchmark_heap_threads(uint64_t threadAmount)
+{
+    thrd_t threads[HEAP_THREADS_MAX];
+
+    nsec_t start = uptime();
+    for (uint64_t i = 0; i < threadAmount; i++)
+    {
+        thrd_create(&threads[i], heap_threads_worker, (void*)i);
+    }
+    for (uint64_t i = 0; i < threadAmount; i++)
+    {
+        thrd_join(threads[i], NULL);
+    }
+    nsec_t end = uptime();
+
+    for (uint64_t i = 0; i < HEAP_THREADS_MAX; i++)
+    {
+        for (uint64_t j = 0; j < HEAP_THREADS_SLOTS; j++)
+        {
+            free(heapThreadsSlots[i][j]);
+            heapThreadsSlots[i][j] = NULL;
+        }
+    }
+
+    char name[32] = "heap threads x";
+    ulltoa(threadAmount, name + strlen(name), 10);
+    print_result(name, end - start, HEAP_THREADS_ITERATIONS * threadAmount);
+}
+
+typedef struct
+{
+    nsec_t end;
+    nsec_t max;
+} exit_storm_t;
+
+static int exit_storm_sleeper(void* arg)
+{
+    exit_storm_t* storm = arg;
+
+    while (uptime() < storm->end)
+    {
+        nsec_t start = uptime();
+        sleep(WAKEUP_INTERVAL);
+        nsec_t elapsed = uptime() - start;
+        nsec_t late = elapsed > WAKEUP_INTERVAL ? elapsed - WAKEUP_INTERVAL : 0;
+        storm->max = late > storm->max ? late : storm->max;
+    }
+
+    return 0;
+}
+
+// Many processes blocked on one pipe exit at once when it is closed. A thread sleeping in short intervals meanwhile
+// measures how late it wakes, which includes any scheduler run that was slowed down by tearing down a process.
+static void benchmark_exit_storm(void)
+{
+    pipefd_t pipefd;
+    if (pipe(&pipefd) == ERR)
+    {
+        print("exit storm: pipe failed\n");
+        return;
+    }
+
+    uint64_t spawned = 0;
+    const char* argv[] = {"home:/usr/bin/pong", NULL};
+    spawn_fd_t fds[] = {{STDIN_FILENO, pipefd.read}, SPAWN_FD_END};
+    for (uint64_t i = 0; i < EXIT_STORM_PROCESSES; i++)
+    {
+        if (spawn(argv, fds, NULL) != ERR)
+        {
+            spawned++;
+        }
+    }
+    close(pipefd.read);
+
+    exit_storm_t storm = {.end = uptime() + EXIT_STORM_DURATION, .max = 0};
+    thrd_t sleeper;
+    thrd_create(&sleeper, exit_storm_sleeper, &storm);
+
+    sleep(EXIT_STORM_DURATION / 4);
+    close(pipefd.write);
+    thrd_join(sleeper, NULL);
+
+    print("exit storm: ");
+    printnum(spawned);
+    print(" processes, wakeup late max ");
+    printnum(storm.max);
+    print(" ns\n");
+    print_file("sys:/stats/sched");
+}
+
+static atomic_bool frameJitterDone;
+static atomic_uint_fast64_t frameJitterClientCalls;
+
+static int frame_jitter_burner(void* arg)
+{
+    while (!atomic_load(&frameJitterDone))
+    {
+    }
+
+    return 0;
+}
+
+// Takes the dwm lock over and over from normal threads that compete with the load, the compositor waits on it.
+static int frame_jitter_client(void* arg)
+{
+    fd_t fd = open("sys:/dwm");
+    if (fd == ERR)
+    {
+        return 0;
+    }
+
+    while (!atomic_load(&frameJitterDone))
+    {
+        ioctl_dwm_size_t size;
+        if (ioctl(fd, IOCTL_DWM_SIZE, &size, sizeof(ioctl_dwm_size_t)) == ERR)
+        {
+            break;
+        }
+        atomic_fetch_add(&frameJitterClientCalls, 1);
+    }
+
+    close(fd);
+    return 0;
+}
+
+// Saturates every cpu with busy threads for a few seconds while the compositor keeps drawing, sys:/stats/dwm shows how
+// far frames started from their period before and after the load. Some of the threads also take the dwm lock, so the
+// jitter includes the time the compositor waits behind clients.
+static void benchmark_frame_jitter(void)
+{
+    print("frame jitter before load:\n");
+    print_file("sys:/stats/dwm");
+
+    thrd_t threads[FRAME_JITTER_LOAD_THREADS + FRAME_JITTER_CLIENT_THREADS];
+    uint64_t created = 0;
+    atomic_init(&frameJitterDone, false);
+    atomic_init(&frameJitterClientCalls, 0);
+    for (; created < FRAME_JITTER_LOAD_THREADS + FRAME_JITTER_CLIENT_THREADS; created++)
+    {
+        thrd_start_t func = created < FRAME_JITTER_LOAD_THREADS ? frame_jitter_burner : frame_jitter_client;
+        if (thrd_create(&threads[created], func, NULL) != thrd_success)
+        {
+            break;
+        }
+    }
+
+    sleep(FRAME_JITTER_DURATION);
+    atomic_store(&frameJitterDone, true);
+    for (uint64_t i = 0; i < created; i++)
+    {
+        thrd_join(threads[i], NULL);
+    }
+
+    print("frame jitter after load, ");
+    printnum(atomic_load(&frameJitterClientCalls));
+    print(" dwm lock calls from clients:\n");
+    print_file("sys:/stats/dwm");
+    print_file("sys:/stats/deadline");
+
+    // The compositor draws whole frames under the dwm lock, with CONFIG_IRQ_OFF_STATS irq_off_max shows that it no
+    // longer does so with interrupts disabled.
+    print_file("sys:/stats/timer");
+}
+
+int main(void)
+{
+    benchmark_heap_churn();
+    benchmark_heap_fragmentation();
+    benchmark_heap_threads(1);
+    benchmark_heap_threads(4);
+    benchmark_heap_threads(HEAP_THREADS_MAX);
+    print_heap_stats();
+    benchmark_null_syscall();
+    benchmark_pipe_readers(1);
+    benchmark_pipe_readers(4);
+    benchmark_pipe_readers(PIPE_READERS_MAX);
+    benchmark_pipe_pingpong();
+    benchmark_wakeup_latency();
+    benchmark_lock_stress(1);
+    benchmark_lock_stress(4);
+    benchmark_lock_stress(LOCK_STRESS_MAX);
+    benchmark_page_churn(1);
+    benchmark_page_churn(4);
+    benchmark_page_churn(PAGE_CHURN_MAX);
+    print_file("sys:/stats/pagecache");
+    benchmark_thread_churn();
+    benchmark_open_close();
+    print_file("sys:/stats/slab");
+    benchmark_exit_storm();
+    benchmark_frame_jitter();
+
+    // Includes the longest time each cpu spent with interrupts disabled, the worst case interrupt latency.
+    print_file("sys:/stats/timer");
+
+    return 0;
+}
@@ -0,0 +1,16 @@
+#include <sys/io.h>
+
+// Echoes stdin back to stdout one byte at a time until the other end closes, used by the benchmark.
+int main(void)
+{
+    char byte;
+    while (read(STDIN_FILENO, &byte, 1) == 1)
+    {
+        if (write(STDOUT_FILENO, &byte, 1) != 1)
+        {
+            break;
+        }
+    }
+
+    return 0;
+}
@@ -66,7 +66,7 @@ static uint64_t procedure(win_t* window, const msg_t* msg)
         if (data->type == LMSG_COMMAND_RELEASE)
         {
             const char* argv[] = {entries[data->id].path, NULL};
-            if (spawn(argv, NULL) == ERR)
+            if (spawn(argv, NULL, NULL) == ERR)
             {
                 // TODO: Add err handling, msg box?
             }
@@ -298,7 +298,7 @@ uint64_t terminal_spawn(const char** argv)
     pipe(&stdout);
 
     spawn_fd_t fds[] = {{STDIN_FILENO, stdin.read}, {STDOUT_FILENO, stdout.write}, SPAWN_FD_END};
-    pid_t pid = spawn(argv, fds);
+    pid_t pid = spawn(argv, fds, NULL);
     if (pid == ERR)
     {
         close(stdin.read);
@@ -0,0 +1,243 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/io.h>
+#include <sys/proc.h>
+
+#define TOP_INTERVAL (SEC)
+#define TOP_BUFFER_SIZE 0x4000
+#define TOP_CPUS_MAX 64
+#define TOP_THREADS_MAX 256
+#define TOP_THREADS_SHOWN 10
+
+typedef struct
+{
+    uint64_t switches;
+    uint64_t idleUs;
+    uint64_t runqueueAvg;
+} cpu_sample_t;
+
+typedef struct
+{
+    uint64_t pid;
+    uint64_t tid;
+    uint64_t priority;
+    uint64_t cpuUs;
+    uint64_t voluntary;
+    uint64_t preempted;
+    uint64_t slowWaits; // Waits of 1ms or more
+    uint64_t cpuPercent;
+} thread_sample_t;
+
+typedef struct
+{
+    nsec_t time;
+    cpu_sample_t cpus[TOP_CPUS_MAX];
+    uint64_t cpuAmount;
+    thread_sample_t threads[TOP_THREADS_MAX];
+    uint64_t threadAmount;
+} sample_t;
+
+static char buffer[TOP_BUFFER_SIZE];
+
+static sample_t samples[2];
+
+static void print(const char* str)
+{
+    write(STDOUT_FILENO, str, strlen(str));
+}
+
+// Right aligns num in a column of width characters.
+static void print_column(uint64_t num, uint64_t width)
+{
+    char str[32];
+    ulltoa(num, str, 10);
+    for (uint64_t i = strlen(str); i < width; i++)
+    {
+        print(" ");
+    }
+    print(str);
+}
+
+static bool read_file(const char* path)
+{
+    fd_t fd = open(path);
+    if (fd == ERR)
+    {
+        return false;
+    }
+
+    uint64_t total = 0;
+    while (total < TOP_BUFFER_SIZE - 1)
+    {
+        uint64_t count = read(fd, buffer + total, TOP_BUFFER_SIZE - 1 - total);
+        if (count == 0 || count == ERR)
+        {
+            break;
+        }
+        total += count;
+    }
+    buffer[total] = '\0';
+
+    close(fd);
+    return true;
+}
+
+// Returns the start of the line following the one str points into, NULL if there is none.
+static const char* next_line(const char* str)
+{
+    const char* newline = strchr(str, '\n');
+    return newline != NULL ? newline + 1 : NULL;
+}
+
+static uint64_t parse_u64(const char** str)
+{
+    while (**str == ' ')
+    {
+        (*str)++;
+    }
+
+    uint64_t num = 0;
+    while (**str >= '0' && **str <= '9')
+    {
+        num = num * 10 + (**str - '0');
+        (*str)++;
+    }
+    return num;
+}
+
+static void sample_take(sample_t* sample)
+{
+    sample->time = uptime();
+    sample->cpuAmount = 0;
+    sample->threadAmount = 0;
+
+    if (read_file("sys:/stats/sched"))
+    {
+        const char* line = next_line(buffer);
+        while (line != NULL && *line != '\0' && sample->cpuAmount < TOP_CPUS_MAX)
+        {
+            cpu_sample_t* cpu = &sample->cpus[sample->cpuAmount++];
+            parse_u64(&line);
+            cpu->switches = parse_u64(&line);
+            cpu->idleUs = parse_u64(&line);
+            cpu->runqueueAvg = parse_u64(&line);
+            line = next_line(line);
+        }
+    }
+
+    if (read_file("sys:/stats/threads"))
+    {
+        const char* line = next_line(buffer);
+        while (line != NULL && *line != '\0' && sample->threadAmount < TOP_THREADS_MAX)
+        {
+            thread_sample_t* thread = &sample->threads[sample->threadAmount++];
+            thread->pid = parse_u64(&line);
+            thread->tid = parse_u64(&line);
+            thread->priority = parse_u64(&line);
+            thread->cpuUs = parse_u64(&line);
+            thread->voluntary = parse_u64(&line);
+            thread->preempted = parse_u64(&line);
+            parse_u64(&line);
+            parse_u64(&line);
+            thread->slowWaits = parse_u64(&line) + parse_u64(&line) + parse_u64(&line) + parse_u64(&line);
+            thread->cpuPercent = 0;
+            line = next_line(line);
+        }
+    }
+}
+
+static const thread_sample_t* sample_find(const sample_t* sample, uint64_t pid, uint64_t tid)
+{
+    for (uint64_t i = 0; i < sample->threadAmount; i++)
+    {
+        if (sample->threads[i].pid == pid && sample->threads[i].tid == tid)
+        {
+            return &sample->threads[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void render(const sample_t* old, sample_t* new)
+{
+    uint64_t intervalUs = (new->time - old->time) / (SEC / 1000000);
+    if (intervalUs == 0)
+    {
+        return;
+    }
+
+    print("\ncpu  busy%  switches/s  runqueue(x100)\n");
+    for (uint64_t i = 0; i < new->cpuAmount && i < old->cpuAmount; i++)
+    {
+        const cpu_sample_t* before = &old->cpus[i];
+        const cpu_sample_t* after = &new->cpus[i];
+        uint64_t idleUs = after->idleUs - before->idleUs;
+        uint64_t busy = idleUs < intervalUs ? 100 - idleUs * 100 / intervalUs : 0;
+
+        print_column(i, 3);
+        print_column(busy, 7);
+        print_column((after->switches - before->switches) * 1000000 / intervalUs, 12);
+        print_column(after->runqueueAvg, 16);
+        print("\n");
+    }
+
+    for (uint64_t i = 0; i < new->threadAmount; i++)
+    {
+        thread_sample_t* thread = &new->threads[i];
+        const thread_sample_t* before = sample_find(old, thread->pid, thread->tid);
+        uint64_t cpuUs = before != NULL ? thread->cpuUs - before->cpuUs : thread->cpuUs;
+        thread->cpuPercent = cpuUs * 100 / intervalUs;
+    }
+
+    print("  pid  tid  prio  cpu%  voluntary  preempted  waits>=1ms\n");
+    for (uint64_t shown = 0; shown < TOP_THREADS_SHOWN && shown < new->threadAmount; shown++)
+    {
+        // Selection sort, only the shown threads need to be ordered.
+        uint64_t best = shown;
+        for (uint64_t i = shown + 1; i < new->threadAmount; i++)
+        {
+            if (new->threads[i].cpuPercent > new->threads[best].cpuPercent)
+            {
+                best = i;
+            }
+        }
+        thread_sample_t temp = new->threads[shown];
+        new->threads[shown] = new->threads[best];
+        new->threads[best] = temp;
+
+        const thread_sample_t* thread = &new->threads[shown];
+        print_column(thread->pid, 5);
+        print_column(thread->tid, 5);
+        print_column(thread->priority, 6);
+        print_column(thread->cpuPercent, 6);
+        print_column(thread->voluntary, 11);
+        print_column(thread->preempted, 11);
+        print_column(thread->slowWaits, 12);
+        print("\n");
+    }
+}
+
+// Prints cpu and thread usage over the last interval until any input arrives.
+int main(void)
+{
+    uint64_t current = 0;
+    sample_take(&samples[current]);
+
+    while (1)
+    {
+        pollfd_t fd = {.fd = STDIN_FILENO, .requested = POLL_READ};
+        poll(&fd, 1, TOP_INTERVAL);
+        if (fd.occurred & POLL_READ)
+        {
+            break;
+        }
+
+        sample_take(&samples[current ^ 1]);
+        render(&samples[current], &samples[current ^ 1]);
+        current ^= 1;
+    }
+
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include "heap.h"
 
+#include <sys/heap.h>
 #include <sys/io.h>
 #include <sys/math.h>
 #include <sys/proc.h>
@@ -7,6 +8,7 @@
 #ifdef __EMBED__
 
 #include "lock.h"
+#include "log.h"
 #include "pmm.h"
 #include "vmm.h"
 
@@ -17,53 +19,76 @@ extern uint64_t _kernelEnd;
 
 #else
 
+#include "thrd.h"
+
+#include <threads.h>
+
+// Singly linked through entry.next, the blocks stay reserved while cached.
+typedef struct
+{
+    heap_header_t* blocks[HEAP_EXACT_BINS];
+    uint64_t counts[HEAP_EXACT_BINS];
+} heap_cache_t;
+
 static fd_t zeroResource;
+static mtx_t lock;
+
+// Indexed by thread block, a new thread that reuses a block also reuses its cache.
+static heap_cache_t caches[_MAX_THRD];
 
 #endif
 
-static heap_header_t* firstBlock;
+_Static_assert(sizeof(heap_header_t) == HEAP_ALIGNMENT, "heap header must keep blocks aligned");
 
-void _HeapBlockSplit(heap_header_t* block, uint64_t size)
-{
-    heap_header_t* newBlock = (heap_header_t*)((uint64_t)block + sizeof(heap_header_t) + size);
-    newBlock->size = block->size - sizeof(heap_header_t) - size;
-    newBlock->next = block->next;
-    newBlock->reserved = false;
-    newBlock->magic = HEAP_HEADER_MAGIC;
+static list_t bins[HEAP_BIN_AMOUNT];
+static uint64_t binMap; // Bit n is set while bins[n] is not empty
 
-    block->size = size;
-    block->next = newBlock;
-}
+// One entirely free arena is kept so that a heap hovering around an arena boundary does not map and unmap over and over.
+static heap_header_t* spareArena;
 
-heap_header_t* _HeapFirstBlock(void)
-{
-    return firstBlock;
-}
+static heap_stats_t stats;
 
 #ifdef __EMBED__
-heap_header_t* _HeapBlockNew(uint64_t size)
+
+// Runs that fit in one buddy block come straight from the page allocator and can be given back, anything larger is
+// mapped page by page after the kernel image and stays with the heap for good.
+static void* _HeapMap(uint64_t size)
 {
-    uint64_t pageAmount = SIZE_IN_PAGES(size + sizeof(heap_header_t));
+    uint64_t pageAmount = SIZE_IN_PAGES(size);
+    if (pageAmount <= (1ULL << PMM_ORDER_MAX))
+    {
+        return pmm_alloc_pages(pageAmount);
+    }
 
-    heap_header_t* newBlock = (heap_header_t*)newAddress;
+    void* address = (void*)newAddress;
     for (uint64_t i = 0; i < pageAmount; i++)
     {
         vmm_kernel_map((void*)(newAddress + i * PAGE_SIZE), VMM_HIGHER_TO_LOWER(pmm_alloc()), PAGE_SIZE);
     }
     newAddress += pageAmount * PAGE_SIZE;
 
-    newBlock->size = pageAmount * PAGE_SIZE - sizeof(heap_header_t);
-    newBlock->next = NULL;
-    newBlock->reserved = false;
-    newBlock->magic = HEAP_HEADER_MAGIC;
+    return address;
+}
+
+static bool _HeapUnmap(void* address, uint64_t size)
+{
+    uint64_t pageAmount = SIZE_IN_PAGES(size);
+    if (pageAmount > (1ULL << PMM_ORDER_MAX))
+    {
+        return false;
+    }
 
-    return newBlock;
+    pmm_free_pages(address, pageAmount);
+    return true;
 }
 
 void _HeapInit(void)
 {
     newAddress = ROUND_UP((uint64_t)&_kernelEnd, PAGE_SIZE);
-    firstBlock = _HeapBlockNew(PAGE_SIZE);
+    for (uint64_t i = 0; i < HEAP_BIN_AMOUNT; i++)
+    {
+        list_init(&bins[i]);
+    }
 
     lock_init(&lock);
 }
@@ -80,37 +105,439 @@ void _HeapRelease(void)
 
 #else
 
-heap_header_t* _HeapBlockNew(uint64_t size)
+static void* _HeapMap(uint64_t size)
+{
+    return mmap(zeroResource, NULL, size, PROT_READ | PROT_WRITE);
+}
+
+static bool _HeapUnmap(void* address, uint64_t size)
+{
+    return munmap(address, size) != ERR;
+}
+
+void _HeapInit(void)
+{
+    zeroResource = open("sys:/zero");
+    for (uint64_t i = 0; i < HEAP_BIN_AMOUNT; i++)
+    {
+        list_init(&bins[i]);
+    }
+
+    mtx_init(&lock, mtx_plain);
+}
+
+void _HeapAcquire(void)
+{
+    mtx_lock(&lock);
+}
+
+void _HeapRelease(void)
+{
+    mtx_unlock(&lock);
+}
+
+#endif
+
+static uint64_t _HeapBinIndex(uint64_t size)
+{
+    if (size <= HEAP_EXACT_MAX)
+    {
+        return size / HEAP_ALIGNMENT - 1;
+    }
+
+    // The first power of two bin holds (HEAP_EXACT_MAX, 2 * HEAP_EXACT_MAX].
+    uint64_t index = HEAP_EXACT_BINS + (63 - __builtin_clzll(size - 1)) - (63 - __builtin_clzll(HEAP_EXACT_MAX));
+    return MIN(index, HEAP_BIN_AMOUNT - 1);
+}
+
+static void _HeapBinInsert(heap_header_t* block)
+{
+    uint64_t index = _HeapBinIndex(block->size);
+    list_append(&bins[index].head, block);
+    binMap |= 1ULL << index;
+
+    stats.free += block->size;
+    stats.freeBlocks++;
+}
+
+static void _HeapBinRemove(heap_header_t* block)
+{
+    uint64_t index = _HeapBinIndex(block->size);
+    list_remove(block);
+    if (list_empty(&bins[index]))
+    {
+        binMap &= ~(1ULL << index);
+    }
+
+    stats.free -= block->size;
+    stats.freeBlocks--;
+}
+
+static heap_header_t* _HeapBinFind(uint64_t size)
 {
-    size = ROUND_UP(size + sizeof(heap_header_t), PAGE_SIZE);
+    uint64_t index = _HeapBinIndex(size);
 
-    heap_header_t* newBlock = mmap(zeroResource, NULL, size, PROT_READ | PROT_WRITE);
-    if (newBlock == NULL)
+    // Only a power of two bin can hold blocks smaller than the request, every bin above it fits any block.
+    if (index >= HEAP_EXACT_BINS && (binMap & (1ULL << index)))
+    {
+        heap_header_t* block;
+        LIST_FOR_EACH(block, &bins[index])
+        {
+            if (block->size >= size)
+            {
+                return block;
+            }
+        }
+        index++;
+    }
+
+    uint64_t mask = binMap & ~((1ULL << index) - 1);
+    if (mask == 0)
     {
         return NULL;
     }
 
-    newBlock->size = size - sizeof(heap_header_t);
-    newBlock->next = NULL;
-    newBlock->reserved = false;
+    return list_first(&bins[__builtin_ctzll(mask)]);
+}
+
+static heap_header_t* _HeapNext(heap_header_t* block)
+{
+    return HEAP_HEADER_GET_END(block);
+}
+
+static heap_header_t* _HeapPrev(heap_header_t* block)
+{
+    return (heap_header_t*)((uint64_t)block - block->prevSize - sizeof(heap_header_t));
+}
+
+// Gives the rest of a block back to the bins if it is large enough to be a block of its own.
+static void _HeapBlockSplit(heap_header_t* block, uint64_t size)
+{
+    if (block->size < size + sizeof(heap_header_t) + HEAP_ALIGNMENT)
+    {
+        return;
+    }
+
+    heap_header_t* newBlock = (heap_header_t*)((uint64_t)HEAP_HEADER_GET_START(block) + size);
     newBlock->magic = HEAP_HEADER_MAGIC;
+    newBlock->size = block->size - size - sizeof(heap_header_t);
+    newBlock->prevSize = size;
+    newBlock->flags = block->flags & HEAP_LAST;
 
-    return newBlock;
+    block->size = size;
+    block->flags &= ~HEAP_LAST;
+
+    if (!(newBlock->flags & HEAP_LAST))
+    {
+        _HeapNext(newBlock)->prevSize = newBlock->size;
+    }
+    _HeapBinInsert(newBlock);
 }
 
-void _HeapInit(void)
+static heap_header_t* _HeapArenaNew(void)
 {
-    zeroResource = open("sys:/zero");
-    firstBlock = _HeapBlockNew(PAGE_SIZE - sizeof(heap_header_t));
+    heap_header_t* block = _HeapMap(HEAP_ARENA_SIZE);
+    if (block == NULL)
+    {
+        return NULL;
+    }
+
+    block->magic = HEAP_HEADER_MAGIC;
+    block->size = HEAP_ARENA_SIZE - sizeof(heap_header_t);
+    block->prevSize = 0;
+    block->flags = HEAP_FIRST | HEAP_LAST;
+
+    stats.mapped += HEAP_ARENA_SIZE;
+    stats.arenas++;
+    return block;
 }
 
-// TODO: Implement user space mutex
-void _HeapAcquire(void)
+// Called with a block that spans its entire arena and is not in a bin.
+static void _HeapArenaFree(heap_header_t* block)
 {
+    uint64_t size = block->size + sizeof(heap_header_t);
+    if (spareArena != NULL && _HeapUnmap(block, size))
+    {
+        stats.mapped -= size;
+        stats.arenas--;
+        stats.released++;
+        return;
+    }
+
+    if (spareArena == NULL)
+    {
+        spareArena = block;
+    }
+    _HeapBinInsert(block);
 }
 
-void _HeapRelease(void)
+static void* _HeapLargeAlloc(uint64_t size)
 {
+    uint64_t mapSize = ROUND_UP(size + sizeof(heap_header_t), PAGE_SIZE);
+    heap_header_t* block = _HeapMap(mapSize);
+    if (block == NULL)
+    {
+        return NULL;
+    }
+
+    block->magic = HEAP_HEADER_MAGIC;
+    block->size = mapSize - sizeof(heap_header_t);
+    block->prevSize = 0;
+    block->flags = HEAP_RESERVED | HEAP_LARGE | HEAP_FIRST | HEAP_LAST;
+
+    stats.mapped += mapSize;
+    stats.largeBlocks++;
+    stats.used += block->size;
+    stats.allocs++;
+    return HEAP_HEADER_GET_START(block);
 }
 
+heap_header_t* _HeapBlockGet(void* ptr)
+{
+    heap_header_t* block = (heap_header_t*)((uint64_t)ptr - sizeof(heap_header_t));
+#ifdef __EMBED__
+    if (block->magic != HEAP_HEADER_MAGIC)
+    {
+        log_panic(NULL, "Invalid heap magic\n");
+    }
+    else if (!(block->flags & HEAP_RESERVED))
+    {
+        log_panic(NULL, "Attempt to free unreserved block at %a, size %d", ptr, block->size);
+    }
 #endif
+    return block;
+}
+
+void* _HeapAlloc(uint64_t size)
+{
+    if (size == 0)
+    {
+        return NULL;
+    }
+    size = ROUND_UP(size, HEAP_ALIGNMENT);
+
+    if (size >= HEAP_LARGE_THRESHOLD)
+    {
+        return _HeapLargeAlloc(size);
+    }
+
+    heap_header_t* block = _HeapBinFind(size);
+    if (block != NULL)
+    {
+        _HeapBinRemove(block);
+        if (block == spareArena)
+        {
+            spareArena = NULL;
+        }
+    }
+    else
+    {
+        block = _HeapArenaNew();
+        if (block == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    _HeapBlockSplit(block, size);
+    block->flags |= HEAP_RESERVED;
+
+    stats.used += block->size;
+    stats.allocs++;
+    return HEAP_HEADER_GET_START(block);
+}
+
+void _HeapFree(void* ptr)
+{
+    heap_header_t* block = _HeapBlockGet(ptr);
+    block->flags &= ~HEAP_RESERVED;
+
+    stats.used -= block->size;
+    stats.frees++;
+
+    if (block->flags & HEAP_LARGE)
+    {
+        uint64_t mapSize = block->size + sizeof(heap_header_t);
+        stats.largeBlocks--;
+        if (_HeapUnmap(block, mapSize))
+        {
+            stats.mapped -= mapSize;
+            stats.released++;
+            return;
+        }
+
+        // Memory that can not be given back becomes an arena of its own.
+        block->flags &= ~HEAP_LARGE;
+        stats.arenas++;
+    }
+
+    if (!(block->flags & HEAP_LAST))
+    {
+        heap_header_t* next = _HeapNext(block);
+        if (!(next->flags & HEAP_RESERVED))
+        {
+            _HeapBinRemove(next);
+            block->size += sizeof(heap_header_t) + next->size;
+            block->flags |= next->flags & HEAP_LAST;
+        }
+    }
+
+    if (!(block->flags & HEAP_FIRST))
+    {
+        heap_header_t* prev = _HeapPrev(block);
+        if (!(prev->flags & HEAP_RESERVED))
+        {
+            _HeapBinRemove(prev);
+            prev->size += sizeof(heap_header_t) + block->size;
+            prev->flags |= block->flags & HEAP_LAST;
+            block = prev;
+        }
+    }
+
+    if (!(block->flags & HEAP_LAST))
+    {
+        _HeapNext(block)->prevSize = block->size;
+    }
+
+    if ((block->flags & (HEAP_FIRST | HEAP_LAST)) == (HEAP_FIRST | HEAP_LAST))
+    {
+        _HeapArenaFree(block);
+        return;
+    }
+    _HeapBinInsert(block);
+}
+
+#ifndef __EMBED__
+
+static void _HeapCachePush(heap_cache_t* cache, uint64_t index, heap_header_t* block)
+{
+    block->entry.next = (list_entry_t*)cache->blocks[index];
+    cache->blocks[index] = block;
+    cache->counts[index]++;
+}
+
+static heap_header_t* _HeapCachePop(heap_cache_t* cache, uint64_t index)
+{
+    heap_header_t* block = cache->blocks[index];
+    cache->blocks[index] = (heap_header_t*)block->entry.next;
+    cache->counts[index]--;
+    return block;
+}
+
+void* _HeapCacheAlloc(uint64_t size)
+{
+    if (size == 0 || size > HEAP_EXACT_MAX)
+    {
+        return NULL;
+    }
+    thrd_block_t* self = _ThrdSelf();
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    uint64_t index = _HeapBinIndex(ROUND_UP(size, HEAP_ALIGNMENT));
+
+    heap_cache_t* cache = &caches[self->index];
+    if (cache->counts[index] == 0)
+    {
+        _HeapAcquire();
+        while (cache->counts[index] < HEAP_CACHE_BATCH)
+        {
+            // A block can be slightly larger than its size class when the rest was too small to split off, it is still
+            // put back by its real size when freed.
+            void* ptr = _HeapAlloc((index + 1) * HEAP_ALIGNMENT);
+            if (ptr == NULL)
+            {
+                break;
+            }
+            _HeapCachePush(cache, index, (heap_header_t*)((uint64_t)ptr - sizeof(heap_header_t)));
+        }
+        _HeapRelease();
+
+        if (cache->counts[index] == 0)
+        {
+            return NULL;
+        }
+    }
+
+    return HEAP_HEADER_GET_START(_HeapCachePop(cache, index));
+}
+
+bool _HeapCacheFree(void* ptr)
+{
+    heap_header_t* block = (heap_header_t*)((uint64_t)ptr - sizeof(heap_header_t));
+    if (block->size > HEAP_EXACT_MAX)
+    {
+        return false;
+    }
+    thrd_block_t* self = _ThrdSelf();
+    if (self == NULL)
+    {
+        return false;
+    }
+    uint64_t index = _HeapBinIndex(block->size);
+
+    heap_cache_t* cache = &caches[self->index];
+    if (cache->counts[index] == HEAP_CACHE_MAX)
+    {
+        _HeapAcquire();
+        while (cache->counts[index] > HEAP_CACHE_MAX - HEAP_CACHE_BATCH)
+        {
+            _HeapFree(HEAP_HEADER_GET_START(_HeapCachePop(cache, index)));
+        }
+        _HeapRelease();
+    }
+
+    _HeapCachePush(cache, index, block);
+    return true;
+}
+
+void _HeapCacheFlush(void)
+{
+    thrd_block_t* self = _ThrdSelf();
+    if (self == NULL)
+    {
+        return;
+    }
+    heap_cache_t* cache = &caches[self->index];
+
+    _HeapAcquire();
+    for (uint64_t i = 0; i < HEAP_EXACT_BINS; i++)
+    {
+        while (cache->counts[i] != 0)
+        {
+            _HeapFree(HEAP_HEADER_GET_START(_HeapCachePop(cache, i)));
+        }
+    }
+    _HeapRelease();
+}
+
+#endif
+
+void heap_stats(heap_stats_t* out)
+{
+    _HeapAcquire();
+
+    *out = stats;
+#ifndef __EMBED__
+    // Only approximate, the caches are changed without the lock.
+    for (uint64_t i = 0; i < _MAX_THRD; i++)
+    {
+        for (uint64_t j = 0; j < HEAP_EXACT_BINS; j++)
+        {
+            out->cached += caches[i].counts[j] * (j + 1) * HEAP_ALIGNMENT;
+        }
+    }
+#endif
+    out->largestFree = 0;
+    if (binMap != 0)
+    {
+        heap_header_t* block;
+        LIST_FOR_EACH(block, &bins[63 - __builtin_clzll(binMap)])
+        {
+            out->largestFree = MAX(out->largestFree, block->size);
+        }
+    }
+
+    _HeapRelease();
+}
@@ -2,31 +2,73 @@
 
 #include <stdbool.h>
 #include <stdint.h>
-
-// TODO: Replace heap with a better algorithm, buddy allocator?
+#include <sys/list.h>
 
 #define HEAP_ALIGNMENT 64
-#define HEAP_BUCKET_AMOUNT 10
 
-#define HEAP_HEADER_GET_START(block) ((void*)((uint64_t)block + sizeof(heap_header_t)))
-#define HEAP_HEADER_GET_END(block) ((void*)((uint64_t)block + sizeof(heap_header_t) + block->size))
+// Requests of at least this size skip the bins and are mapped directly from the system.
+#define HEAP_LARGE_THRESHOLD (128 * 1024)
+
+// Size of the regions of memory that small requests are carved from.
+#define HEAP_ARENA_SIZE (512 * 1024)
+
+// Free blocks up to HEAP_EXACT_MAX are binned by exact size, larger ones by power of two.
+#define HEAP_EXACT_MAX 1024
+#define HEAP_EXACT_BINS (HEAP_EXACT_MAX / HEAP_ALIGNMENT)
+#define HEAP_BIN_AMOUNT 32
+
+// Every thread keeps up to HEAP_CACHE_MAX free blocks of each exact size, moved from and to the shared bins
+// HEAP_CACHE_BATCH at a time.
+#define HEAP_CACHE_MAX 16
+#define HEAP_CACHE_BATCH 8
+
+#define HEAP_HEADER_GET_START(block) ((void*)((uint64_t)(block) + sizeof(heap_header_t)))
+#define HEAP_HEADER_GET_END(block) ((void*)((uint64_t)(block) + sizeof(heap_header_t) + (block)->size))
 #define HEAP_HEADER_MAGIC 0xBC709F7DE48C8381
 
-// Should be exactly 64 bytes long
+typedef enum
+{
+    HEAP_RESERVED = (1 << 0),
+    HEAP_LARGE = (1 << 1), // Mapped on its own, returned to the system when freed
+    HEAP_FIRST = (1 << 2), // No block before it in its arena
+    HEAP_LAST = (1 << 3),  // No block after it in its arena
+} heap_flags_t;
+
+// Should be exactly 64 bytes long. The blocks of an arena are laid out back to back, prevSize acts as the boundary tag
+// of the block before so both neighbours of a freed block are found without a walk.
 typedef struct heap_header
 {
+    list_entry_t entry; // In a bin while free
     uint64_t magic;
     uint64_t size;
-    uint64_t reserved;
-    struct heap_header* next;
-    uint64_t padding[4];
+    uint64_t prevSize;
+    heap_flags_t flags;
+    uint64_t padding[2];
 } heap_header_t;
 
-heap_header_t* _HeapBlockNew(uint64_t size);
+// Called with the heap lock held.
+void* _HeapAlloc(uint64_t size);
+
+// Called with the heap lock held.
+void _HeapFree(void* ptr);
+
+// Called with the heap lock held, validates the block in the kernel.
+heap_header_t* _HeapBlockGet(void* ptr);
+
+#ifndef __EMBED__
+
+// Takes a block from the cache of the calling thread without the heap lock, returns NULL if size is not cached, the
+// thread was not started by thrd_create() or there is no memory left.
+void* _HeapCacheAlloc(uint64_t size);
+
+// Puts a block in the cache of the calling thread without the heap lock, returns false if its size is not cached or
+// the thread was not started by thrd_create(). The block can come from any thread.
+bool _HeapCacheFree(void* ptr);
 
-void _HeapBlockSplit(heap_header_t* block, uint64_t size);
+// Gives every block in the cache of the calling thread back to the shared bins.
+void _HeapCacheFlush(void);
 
-heap_header_t* _HeapFirstBlock(void);
+#endif
 
 void _HeapInit(void);
 
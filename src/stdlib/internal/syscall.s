@@ -1,14 +1,12 @@
 %ifndef __EMBED__
 
-%define SYSCALL_VECTOR 0x80
-
 section .text
 
 ;rdi = selector
 global _Syscall0
 _Syscall0:
     mov rax, rdi
-    int SYSCALL_VECTOR
+    syscall
     ret
 
 ;rdi = arg1
@@ -16,7 +14,7 @@ _Syscall0:
 global _Syscall1
 _Syscall1:
     mov rax, rsi
-    int SYSCALL_VECTOR
+    syscall
     ret
 
 ;rdi = arg1
@@ -25,7 +23,7 @@ _Syscall1:
 global _Syscall2
 _Syscall2:
     mov rax, rdx
-    int SYSCALL_VECTOR
+    syscall
     ret
 
 ;rdi = arg1
@@ -35,7 +33,7 @@ _Syscall2:
 global _Syscall3
 _Syscall3:
     mov rax, rcx
-    int SYSCALL_VECTOR
+    syscall
     ret
 
 ;rdi = arg1
@@ -46,7 +44,8 @@ _Syscall3:
 global _Syscall4
 _Syscall4:
     mov rax, r8
-    int SYSCALL_VECTOR
+    mov r10, rcx
+    syscall
     ret
 
 ;rdi = arg1
@@ -58,7 +57,8 @@ _Syscall4:
 global _Syscall5
 _Syscall5:
     mov rax, r9
-    int SYSCALL_VECTOR
+    mov r10, rcx
+    syscall
     ret
 
 %endif
@@ -6,12 +6,14 @@ static thrd_block_t blocks[_MAX_THRD];
 
 void _ThrdInit(void)
 {
+    blocks[0].self = &blocks[0];
     atomic_init(&blocks[0].ref, 1);
     atomic_init(&blocks[0].running, true);
     blocks[0].index = 0;
     blocks[0].id = gettid();
     blocks[0].result = 0;
     blocks[0].err = 0;
+    settls(&blocks[0]);
 }
 
 thrd_block_t* _ThrdBlockReserve(void)
@@ -21,6 +23,7 @@ thrd_block_t* _ThrdBlockReserve(void)
         atomic_long expected = 0;
         if (atomic_compare_exchange_strong(&blocks[i].ref, &expected, 1))
         {
+            blocks[i].self = &blocks[i];
             atomic_init(&blocks[i].running, false);
             blocks[i].index = i;
             blocks[i].id = 0;
@@ -9,10 +9,11 @@
 
 #define _MAX_THRD 32
 
-typedef struct
+typedef struct thrd_block
 {
+    struct thrd_block* self; // Read through fs by _ThrdSelf()
     atomic_long ref;
-    atomic_bool running;
+    _Atomic(uint64_t) running; // Used as a futex by thread creation and thrd_join
     uint8_t index;
     tid_t id;
     uint8_t result;
@@ -31,6 +32,18 @@ thrd_block_t* _ThrdBlockById(tid_t id);
 
 thrd_block_t* _ThrdBlockByIndex(uint64_t index);
 
+// Futex calls operate on plain 64 bit words, which _Atomic(uint64_t) is layout compatible with.
+#define _THRD_FUTEX(word) ((uint64_t*)(word))
+
+// The fs base of every thread started by thrd_create() and of the main thread points at its block, other threads get
+// NULL.
+static inline thrd_block_t* _ThrdSelf(void)
+{
+    thrd_block_t* self;
+    __asm__("mov %%fs:0, %0" : "=r"(self));
+    return self;
+}
+
 static inline thrd_block_t* _ThrdBlockRef(thrd_block_t* block)
 {
     atomic_fetch_add(&block->ref, 1);
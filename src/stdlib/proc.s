@@ -59,4 +59,34 @@ yield:
     SYSTEM_CALL SYS_YIELD
     ret
 
+global futex_wait
+futex_wait:
+    SYSTEM_CALL SYS_FUTEX_WAIT
+    ret
+
+global futex_wake
+futex_wake:
+    SYSTEM_CALL SYS_FUTEX_WAKE
+    ret
+
+global nice
+nice:
+    SYSTEM_CALL SYS_NICE
+    ret
+
+global affinity
+affinity:
+    SYSTEM_CALL SYS_AFFINITY
+    ret
+
+global deadline
+deadline:
+    SYSTEM_CALL SYS_DEADLINE
+    ret
+
+global settls
+settls:
+    SYSTEM_CALL SYS_SETTLS
+    ret
+
 %endif
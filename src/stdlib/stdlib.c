@@ -4,84 +4,18 @@
 
 #include "internal/heap.h"
 
-#ifdef __EMBED__
-#include "log.h"
-#endif
-
-static void* malloc_unlocked(size_t size)
-{
-    if (size == 0)
-    {
-        return NULL;
-    }
-    size = ROUND_UP(size, HEAP_ALIGNMENT);
-
-    heap_header_t* currentBlock = _HeapFirstBlock();
-    while (true)
-    {
-        if (!currentBlock->reserved)
-        {
-            if (currentBlock->size == size)
-            {
-                currentBlock->reserved = true;
-
-                return HEAP_HEADER_GET_START(currentBlock);
-            }
-            else if (currentBlock->size > size + sizeof(heap_header_t) + HEAP_ALIGNMENT)
-            {
-                currentBlock->reserved = true;
-                _HeapBlockSplit(currentBlock, size);
-
-                return HEAP_HEADER_GET_START(currentBlock);
-            }
-        }
-
-        if (currentBlock->next != NULL)
-        {
-            currentBlock = currentBlock->next;
-        }
-        else
-        {
-            break;
-        }
-    }
-
-    heap_header_t* newBlock = _HeapBlockNew(size);
-    if (newBlock == NULL)
-    {
-        return NULL;
-    }
-
-    if (newBlock->size > size + sizeof(heap_header_t) + HEAP_ALIGNMENT)
-    {
-        _HeapBlockSplit(newBlock, size);
-    }
-    currentBlock->next = newBlock;
-    newBlock->reserved = true;
-
-    return HEAP_HEADER_GET_START(newBlock);
-}
-
-static void free_unlocked(void* ptr)
+void* malloc(size_t size)
 {
-    heap_header_t* block = (heap_header_t*)((uint64_t)ptr - sizeof(heap_header_t));
-#ifdef __EMBED__
-    if (block->magic != HEAP_HEADER_MAGIC)
+#ifndef __EMBED__
+    void* cached = _HeapCacheAlloc(size);
+    if (cached != NULL)
     {
-        log_panic(NULL, "Invalid heap magic\n");
-    }
-    else if (!block->reserved)
-    {
-        log_panic(NULL, "Attempt to free unreserved block at %a, size %d", ptr, block->size);
+        return cached;
     }
 #endif
-    block->reserved = false;
-}
 
-void* malloc(size_t size)
-{
     _HeapAcquire();
-    void* ptr = malloc_unlocked(size);
+    void* ptr = _HeapAlloc(size);
     _HeapRelease();
     return ptr;
 }
@@ -99,18 +33,31 @@ void* calloc(size_t num, size_t size)
 
 void* realloc(void* ptr, size_t size)
 {
+    if (ptr == NULL)
+    {
+        return malloc(size);
+    }
+    else if (size == 0)
+    {
+        free(ptr);
+        return NULL;
+    }
+
     _HeapAcquire();
-    heap_header_t* block = (heap_header_t*)((uint64_t)ptr - sizeof(heap_header_t));
-#ifdef __EMBED__
-    if (block->magic != HEAP_HEADER_MAGIC)
+    heap_header_t* block = _HeapBlockGet(ptr);
+    if (size <= block->size)
     {
-        log_panic(NULL, "Invalid heap magic\n");
+        _HeapRelease();
+        return ptr;
     }
-#endif
 
-    void* newPtr = malloc_unlocked(size);
-    memcpy(newPtr, ptr, MIN(size, block->size));
-    free_unlocked(ptr);
+    // The old block is kept if there is no memory for the new one.
+    void* newPtr = _HeapAlloc(size);
+    if (newPtr != NULL)
+    {
+        memcpy(newPtr, ptr, block->size);
+        _HeapFree(ptr);
+    }
 
     _HeapRelease();
     return newPtr;
@@ -118,8 +65,20 @@ void* realloc(void* ptr, size_t size)
 
 void free(void* ptr)
 {
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+#ifndef __EMBED__
+    if (_HeapCacheFree(ptr))
+    {
+        return;
+    }
+#endif
+
     _HeapAcquire();
-    free_unlocked(ptr);
+    _HeapFree(ptr);
     _HeapRelease();
 }
 
@@ -272,11 +272,13 @@ static char* errorStrings[] = {
     "no such resource",
     "broken pipe",
     "busy",
+    "try again",
+    "timed out",
 };
 
 char* strerror(int error)
 {
-    if (error > EBUSY || error < 0)
+    if (error > ETIMEDOUT || error < 0)
     {
         return "unknown error";
     }
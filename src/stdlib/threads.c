@@ -1,16 +1,20 @@
 #ifndef __EMBED__
 
+#include <errno.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <sys/proc.h>
 
+#include "internal/heap.h"
 #include "internal/thrd.h"
 
 static void _ThrdEntry(thrd_block_t* block, thrd_start_t func, void* arg)
 {
+    settls(block);
+
     while (!atomic_load(&block->running))
     {
-        yield();
+        futex_wait(_THRD_FUTEX(&block->running), false, NEVER);
     }
 
     int res = func(arg);
@@ -33,6 +37,7 @@ int thrd_create(thrd_t* thr, thrd_start_t func, void* arg)
     }
 
     atomic_store(&block->running, true);
+    futex_wake(_THRD_FUTEX(&block->running), 1);
 
     thr->index = block->index;
     return thrd_success;
@@ -67,9 +72,12 @@ void thrd_yield(void)
 
 _NORETURN void thrd_exit(int res)
 {
+    _HeapCacheFlush();
+
     thrd_block_t* block = _ThrdBlockById(gettid());
     block->result = res;
     atomic_store(&block->running, false);
+    futex_wake(_THRD_FUTEX(&block->running), UINT64_MAX);
     _ThrdBlockUnref(block);
     _ThrdBlockUnref(block); // Dereference base reference
     thread_exit();
@@ -89,10 +97,9 @@ int thrd_join(thrd_t thr, int* res)
         return thrd_error;
     }
 
-    // TODO: Implement kernel side blocking for this
     while (atomic_load(&block->running))
     {
-        sleep(SEC / 1000);
+        futex_wait(_THRD_FUTEX(&block->running), true, NEVER);
     }
 
     if (res != NULL)
@@ -103,4 +110,205 @@ int thrd_join(thrd_t thr, int* res)
     return thrd_success;
 }
 
+// Returns the time left until timePoint, which is relative to uptime().
+static nsec_t _ThrdTimeout(const struct timespec* timePoint)
+{
+    nsec_t deadline = (nsec_t)timePoint->tv_sec * SEC + (nsec_t)timePoint->tv_nsec;
+    nsec_t time = uptime();
+    return deadline > time ? deadline - time : 0;
+}
+
+int mtx_init(mtx_t* mtx, int type)
+{
+    mtx->state = 0;
+    mtx->type = type;
+    mtx->owner = 0;
+    mtx->depth = 0;
+    return thrd_success;
+}
+
+// Acquires the futex word, the uncontended case is a single compare exchange and never enters the kernel.
+static int _MtxAcquire(mtx_t* mtx, nsec_t timeout)
+{
+    uint64_t state = 0;
+    if (__atomic_compare_exchange_n(&mtx->state, &state, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        return thrd_success;
+    }
+
+    nsec_t deadline = timeout == NEVER ? NEVER : uptime() + timeout;
+    if (state != 2)
+    {
+        state = __atomic_exchange_n(&mtx->state, 2, __ATOMIC_ACQUIRE);
+    }
+
+    while (state != 0)
+    {
+        nsec_t remaining = NEVER;
+        if (deadline != NEVER)
+        {
+            nsec_t time = uptime();
+            if (time >= deadline)
+            {
+                return thrd_timedout;
+            }
+            remaining = deadline - time;
+        }
+
+        futex_wait(&mtx->state, 2, remaining);
+        state = __atomic_exchange_n(&mtx->state, 2, __ATOMIC_ACQUIRE);
+    }
+
+    return thrd_success;
+}
+
+static int _MtxLock(mtx_t* mtx, nsec_t timeout)
+{
+    if (mtx->type & mtx_recursive)
+    {
+        tid_t self = gettid();
+        if (__atomic_load_n(&mtx->owner, __ATOMIC_RELAXED) == self)
+        {
+            mtx->depth++;
+            return thrd_success;
+        }
+
+        int result = _MtxAcquire(mtx, timeout);
+        if (result == thrd_success)
+        {
+            __atomic_store_n(&mtx->owner, self, __ATOMIC_RELAXED);
+            mtx->depth = 1;
+        }
+        return result;
+    }
+
+    return _MtxAcquire(mtx, timeout);
+}
+
+int mtx_lock(mtx_t* mtx)
+{
+    return _MtxLock(mtx, NEVER);
+}
+
+int mtx_timedlock(mtx_t* mtx, const struct timespec* timePoint)
+{
+    return _MtxLock(mtx, _ThrdTimeout(timePoint));
+}
+
+int mtx_trylock(mtx_t* mtx)
+{
+    if (mtx->type & mtx_recursive && __atomic_load_n(&mtx->owner, __ATOMIC_RELAXED) == gettid())
+    {
+        mtx->depth++;
+        return thrd_success;
+    }
+
+    uint64_t state = 0;
+    if (!__atomic_compare_exchange_n(&mtx->state, &state, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        return thrd_busy;
+    }
+
+    if (mtx->type & mtx_recursive)
+    {
+        __atomic_store_n(&mtx->owner, gettid(), __ATOMIC_RELAXED);
+        mtx->depth = 1;
+    }
+    return thrd_success;
+}
+
+int mtx_unlock(mtx_t* mtx)
+{
+    if (mtx->type & mtx_recursive)
+    {
+        if (--mtx->depth != 0)
+        {
+            return thrd_success;
+        }
+        __atomic_store_n(&mtx->owner, 0, __ATOMIC_RELAXED);
+    }
+
+    // Only enter the kernel if another thread may be waiting.
+    if (__atomic_exchange_n(&mtx->state, 0, __ATOMIC_RELEASE) == 2)
+    {
+        futex_wake(&mtx->state, 1);
+    }
+    return thrd_success;
+}
+
+void mtx_destroy(mtx_t* mtx)
+{
+}
+
+int cnd_init(cnd_t* cond)
+{
+    cond->sequence = 0;
+    cond->waiters = 0;
+    return thrd_success;
+}
+
+int cnd_signal(cnd_t* cond)
+{
+    // Pairs with the increment of waiters in _CndWait(), a waiter that is not seen here reads the new sequence.
+    __atomic_fetch_add(&cond->sequence, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&cond->waiters, __ATOMIC_SEQ_CST) != 0)
+    {
+        futex_wake(&cond->sequence, 1);
+    }
+    return thrd_success;
+}
+
+int cnd_broadcast(cnd_t* cond)
+{
+    __atomic_fetch_add(&cond->sequence, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&cond->waiters, __ATOMIC_SEQ_CST) != 0)
+    {
+        futex_wake(&cond->sequence, UINT64_MAX);
+    }
+    return thrd_success;
+}
+
+static int _CndWait(cnd_t* cond, mtx_t* mtx, nsec_t timeout)
+{
+    __atomic_fetch_add(&cond->waiters, 1, __ATOMIC_SEQ_CST);
+    uint64_t sequence = __atomic_load_n(&cond->sequence, __ATOMIC_SEQ_CST);
+
+    // A recursive mutex is fully released while waiting and restored to the same depth afterwards.
+    uint64_t depth = mtx->depth;
+    mtx->depth = 1;
+    mtx_unlock(mtx);
+
+    uint64_t result = futex_wait(&cond->sequence, sequence, timeout);
+    bool timedOut = result == ERR && errno == ETIMEDOUT;
+    __atomic_fetch_sub(&cond->waiters, 1, __ATOMIC_RELAXED);
+
+    // Other threads may still be waiting on the mutex, so it is reacquired in the contended state.
+    while (__atomic_exchange_n(&mtx->state, 2, __ATOMIC_ACQUIRE) != 0)
+    {
+        futex_wait(&mtx->state, 2, NEVER);
+    }
+
+    if (mtx->type & mtx_recursive)
+    {
+        __atomic_store_n(&mtx->owner, gettid(), __ATOMIC_RELAXED);
+        mtx->depth = depth;
+    }
+
+    return timedOut ? thrd_timedout : thrd_success;
+}
+
+int cnd_wait(cnd_t* cond, mtx_t* mtx)
+{
+    return _CndWait(cond, mtx, NEVER);
+}
+
+int cnd_timedwait(cnd_t* cond, mtx_t* mtx, const struct timespec* timePoint)
+{
+    return _CndWait(cond, mtx, _ThrdTimeout(timePoint));
+}
+
+void cnd_destroy(cnd_t* cond)
+{
+}
+
 #endif